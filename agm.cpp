@@ -9,8 +9,12 @@
  */
 
 #include <cassert>
+#include <climits>
+#include <algorithm>
 #include <iostream>
 #include "agm.h"
+#include "taskpool.h"
+#include "agmlane.h"
 #include "angle.h"
 using namespace std;
 
@@ -28,94 +32,992 @@ using namespace std;
  * the angle between a and g at each iteration.
  */
 
+AgmBranch::AgmBranch(const string &str)
+{
+  size_t i;
+  len=0;
+  for (i=0;i<str.length();i++)
+    push_back(str[i]);
+}
+
+AgmBranch::AgmBranch(const char *str)
+{
+  len=0;
+  while (*str)
+    push_back(*str++);
+}
+
+AgmBranch::operator string() const
+{
+  string ret(bytes,(len<inlineDepth)?len:inlineDepth);
+  return ret+spill;
+}
+
+void AgmBranch::resize(size_t n,char c)
+{
+  while (len>n)
+  {
+    len--;
+    if (len>=inlineDepth)
+      spill.pop_back();
+  }
+  while (len<n)
+    push_back(c);
+}
+
+void AgmBranch::clear()
+{
+  len=0;
+  spill.clear();
+}
+
+size_t AgmBranch::trimmedLength() const
+// Returns the length without trailing null bytes, which do not change the branch.
+{
+  size_t ret=len;
+  while (ret && (*this)[ret-1]==0)
+    ret--;
+  return ret;
+}
+
+template<typename T> complex<double> complexDouble(complex<T> z)
+{
+  return complex<double>((double)z.real(),(double)z.imag());
+}
+
+template<typename T> AgmRecT<T> agm1(AgmRecT<T> ag)
+{
+  AgmRecT<T> ret;
+  complex<T> c;
+  complex<double> dir=cossin(ag.d);
+  ret.a=(ag.a+ag.g)/T(2);
+  ret.g=sqrt(ag.a*ag.g);
+  c=ret.a*complex<T>(dir.real(),dir.imag());
+  if (abs(c-ret.g)>abs(c+ret.g))
+    ret.g=-ret.g;
+  ret.d=argi(complexDouble(ret.g/ret.a));
+  return ret;
+}
+
 AgmRec agm1(AgmRec ag)
+{
+  return agm1<double>(ag);
+}
+
+/* agm1 spends more time on cossin and argi than on the AGM step. agm1Byte
+ * does the same step, but it takes d and returns it rounded to a whole branch
+ * byte, which is all that agm uses, and does without transcendental functions.
+ * The direction for the byte comes from a table of the 256 values of cossin.
+ * The sign of g is chosen by the sign of Re(c*conj(g)), and the byte of g/a
+ * is found by turning g*conj(a) into the octant around the positive real axis
+ * and bisecting with cross products against a table of the directions halfway
+ * between bytes. If either test is too close to call, it falls back to the
+ * computation in agm1, so the branch bytes are the same as agm1's. argi
+ * rounds the angle to 2**-31 turn, which moves the edges between bytes by
+ * up to 2**-32 turn (1.46e-9 radian), so the margin for the edges is wider.
+ */
+
+const double agmByteMargin=1e-12;
+const double agmEdgeMargin=4e-9;
+const double agmBoundSlack=1e-12;
+
+struct AgmByteTables
+{
+  complex<double> dir[256];
+  complex<double> edge[65]; // edge[i] is halfway between bytes i-33 and i-32
+  AgmByteTables();
+};
+
+AgmByteTables::AgmByteTables()
+{
+  int i;
+  for (i=0;i<256;i++)
+    dir[i]=cossin((signed char)i*0x800000);
+  for (i=0;i<65;i++)
+    edge[i]=cossin((2*i-65)*0x400000);
+}
+
+const AgmByteTables agmByteTables;
+
+int agmByte(complex<double> g,complex<double> a)
+/* Returns the branch byte of the direction of g/a, from -128 to 127,
+ * or 256 if it is too close to the edge between two bytes.
+ */
+{
+  double x=g.real()*a.real()+g.imag()*a.imag(); // g*conj(a)
+  double y=g.imag()*a.real()-g.real()*a.imag();
+  double t,cross,tol;
+  int quad,lo=-32,hi=32,mid;
+  tol=(fabs(x)+fabs(y))*agmEdgeMargin;
+  if (!(tol>0))
+    return 256;
+  if (fabs(x)>=fabs(y))
+    quad=(x<0)?2:0;
+  else
+    quad=(y<0)?-1:1;
+  switch (quad)
+  {
+    case 1:
+      t=x;
+      x=y;
+      y=-t;
+      break;
+    case -1:
+      t=x;
+      x=-y;
+      y=t;
+      break;
+    case 2:
+      x=-x;
+      y=-y;
+      break;
+  }
+  while (lo<hi)
+  {
+    mid=(lo+hi+65)/2-32;
+    cross=agmByteTables.edge[mid+32].real()*y-agmByteTables.edge[mid+32].imag()*x;
+    if (fabs(cross)<tol)
+      return 256;
+    if (cross>0)
+      lo=mid;
+    else
+      hi=mid-1;
+  }
+  return (signed char)(quad*64+lo);
+}
+
+AgmRec agm1Byte(AgmRec ag)
 {
   AgmRec ret;
   complex<double> c;
+  double dot;
+  int byte;
   ret.a=(ag.a+ag.g)/2.;
   ret.g=sqrt(ag.a*ag.g);
-  c=ret.a*cossin(ag.d);
-  if (abs(c-ret.g)>abs(c+ret.g))
+  c=ret.a*agmByteTables.dir[(((unsigned)ag.d+0x400000)>>23)&255];
+  dot=c.real()*ret.g.real()+c.imag()*ret.g.imag();
+  if (fabs(dot)>(norm(c)+norm(ret.g))*agmByteMargin)
+  {
+    if (dot<0)
+      ret.g=-ret.g;
+  }
+  else if (abs(c-ret.g)>abs(c+ret.g))
     ret.g=-ret.g;
-  ret.d=argi(ret.g/ret.a);
+  byte=agmByte(ret.g,ret.a);
+  if (byte>255)
+    byte=(argi(ret.g/ret.a)+0x400000)>>23;
+  ret.d=(int)(signed char)byte<<23;
+  return ret;
+}
+
+AgmRun::AgmRun(complex<double> a,complex<double> g,const AgmBranch &br)
+{
+  prev.a=in.a=out.a=a;
+  prev.g=in.g=out.g=g;
+  branch=br;
+  n=branch.trimmedLength();
+  i=0;
+  converged=done=false;
+  consistent=true;
+}
+
+void AgmRun::step()
+/* consistent is cleared if the byte of a step, used as d, might not choose
+ * the same square root, which happens when a is 0 or nearly perpendicular
+ * to g. Until then, agm with result as the branch takes the same steps.
+ */
+{
+  complex<double> c;
+  double dot;
+  if (!done)
+  {
+    if (i<n)
+      in.d=branch[i]<<23;
+    else
+      in.d=0;
+    out=agm1Byte(in);
+    result+=(char)((out.d+0x400000)>>23);
+    ++i;
+    c=out.a*agmByteTables.dir[((unsigned)out.d>>23)&255];
+    dot=c.real()*out.g.real()+c.imag()*out.g.imag();
+    if (!(dot>(norm(c)+norm(out.g))*agmByteMargin))
+      consistent=false;
+    converged=out.a==out.g || out.g==0. || (out.a==in.a && out.g==in.g) ||
+	      (i>1 && out.a==prev.a && out.g==prev.g);
+    if (i>=n && converged)
+      done=true;
+    else
+    {
+      prev=in;
+      in=out;
+    }
+  }
+}
+
+void AgmRun::advance(unsigned steps)
+{
+  while (!done && i<steps)
+    step();
+}
+
+void AgmRun::finish()
+{
+  while (!done)
+    step();
+}
+
+bool AgmRun::rebranch(const AgmBranch &br)
+/* Changes the branch to br, whose first i bytes must choose the same signs
+ * as those of branch, and sets done as agm would with br. Returns false,
+ * leaving the run unchanged, if agm with br might have stopped before step i.
+ */
+{
+  unsigned newn=br.trimmedLength();
+  if (newn<i)
+    return false;
+  if (done)
+  {
+    prev=in;
+    in=out;
+  }
+  branch=br;
+  n=newn;
+  done=i>=n && converged;
+  return true;
+}
+
+AgmResult agm(complex<double> a,complex<double> g,const AgmBranch &branch)
+{
+  AgmResult ret;
+  AgmRun run(a,g,branch);
+  run.finish();
+  ret.m=run.mean();
+  ret.branch=run.result;
   return ret;
 }
 
-AgmResult agm(complex<double> a,complex<double> g,string branch)
+unsigned agmStepsLeft(double e,double tolerance)
+/* Returns how many more steps it should take for the relative difference
+ * between a and g to go from e to below tolerance. Convergence is
+ * quadratic: if a=g(1+e), the next step has a/g-1 close to e²/8. If e is
+ * too big for that, it returns UINT_MAX.
+ */
 {
+  unsigned n=0;
+  if (e>=1)
+    return UINT_MAX;
+  while (e>tolerance)
+  {
+    e=e*e/8;
+    n++;
+  }
+  return n;
+}
+
+AgmResult agmTol(complex<double> a,complex<double> g,double tolerance,
+		 const AgmBranch &branch,unsigned *iterations,unsigned maxIterations)
+/* Like agm, but stops as soon as the mean is known to within tolerance
+ * (relative), or after maxIterations steps, whichever is first. Once the
+ * branch is used up and the predictor says the next step would get within
+ * tolerance, it returns the arithmetic mean, which is that step's a, instead
+ * of doing it. If iterations is not null, it is set to the number of steps
+ * done; if it equals maxIterations, the mean may be less accurate than asked.
+ */
+{
+  AgmRun run(a,g,branch);
   AgmResult ret;
-  AgmRec in,out;
-  size_t pos;
-  int i=0;
+  bool early=false;
+  while (!run.done && !early && run.i<maxIterations)
+  {
+    if (run.i>=run.n && run.out.g!=0.)
+      early=agmStepsLeft(abs(run.out.a-run.out.g)/abs(run.out.g),tolerance)<=1;
+    if (!early)
+      run.step();
+  }
+  if (early)
+    ret.m=(run.out.a+run.out.g)/2.;
+  else
+    ret.m=run.mean();
+  ret.branch=run.result;
+  if (iterations)
+    *iterations=run.i;
+  return ret;
+}
+
+template<typename T> AgmResultT<T> agm(complex<T> a,complex<T> g,const AgmBranch &branch)
+/* Takes the same steps as agm on doubles, but with agm1 instead of AgmRun,
+ * so that it works for any type that agm1 does. a and g can end up swapping
+ * their last bits back and forth, so it also stops if a step returns to the
+ * state before the last one. In a type that is not rounded correctly, like
+ * DoubleDouble, they can drift apart in their last bits forever, so it stops
+ * when they are within a few epsilons.
+ */
+{
+  AgmRecT<T> prev,in,out;
+  AgmResultT<T> ret;
+  unsigned i,n=branch.trimmedLength();
+  bool converged;
   in.a=a;
   in.g=g;
-  pos=branch.find_last_not_of('\0');
-  if (pos<branch.length())
-    branch.erase(pos+1);
-  else
-    branch.clear();
-  while (true)
+  for (i=0;;i++)
   {
-    if (i<branch.length())
+    if (i<n)
       in.d=branch[i]<<23;
     else
       in.d=0;
     out=agm1(in);
     ret.branch+=(char)((out.d+0x400000)>>23);
-    ++i;
-    if (i>=branch.length() && (out.a==out.g || out.g==0.
-			       || (out.a==in.a && out.g==in.g)))
+    converged=out.a==out.g || out.g==complex<T>() || (out.a==in.a && out.g==in.g) ||
+	      (i && out.a==prev.a && out.g==prev.g);
+    if (!numeric_limits<T>::is_iec559)
+      converged=converged || abs(out.a-out.g)<=T(16)*numeric_limits<T>::epsilon()*abs(out.g);
+    if (i+1>=n && converged)
       break;
+    prev=in;
     in=out;
   }
   ret.m=out.g;
   return ret;
 }
 
-vector<complex<double> > agmLattice(complex<double> a,complex<double> g,unsigned depth,unsigned level,string branch)
+bool agmLatticeSplit(complex<double> a,complex<double> g,AgmRun &run,AgmRun &other,
+		     unsigned level,AgmResult &otherLeaf)
+/* run has done level steps, or stopped sooner. Sets other to the run of
+ * the right child and advances run to be the left child. Returns true if
+ * the leftmost leaf of the right child is known; it is put in otherLeaf.
+ *
+ * The other side is agm with the branch returned by the run that turned
+ * byte level around. If that run is consistent, the other side's run after
+ * level+1 steps is the same, and its leftmost leaf is the same as the whole
+ * run, unless the new branch has fewer nonzero bytes.
+ */
 {
-  vector<complex<double> > ret,otherSide;
-  AgmResult result;
-  int i;
+  AgmRun full(run);
+  AgmBranch branch;
+  unsigned flippedLength;
+  bool otherFirst=false;
+  other=run;
+  branch=run.branch;
+  if (branch.length()<=level)
+    branch.resize(level+1);
+  branch[level]^=0x80;
+  if (!other.rebranch(branch))
+  {
+    other=AgmRun(a,g,branch);
+    other.advance(level);
+  }
+  other.advance(level+1);
+  flippedLength=other.n;
+  full=other;
+  full.finish();
+  if (other.consistent && other.rebranch(full.result))
+    otherFirst=full.consistent && other.n>=flippedLength;
+  else
+  {
+    other=AgmRun(a,g,full.result);
+    other.advance(level+1);
+  }
+  if (otherFirst)
+  {
+    otherLeaf.m=full.mean();
+    otherLeaf.branch=full.result;
+  }
+  run.advance(level+1);
+  return otherFirst;
+}
+
+void agmLattice(complex<double> a,complex<double> g,AgmRun &run,unsigned depth,
+		unsigned level,complex<double> *out,bool haveFirst)
+/* run has done level steps, or stopped sooner. The leaves of its subtree
+ * go in out[0] through out[2**(depth-level)-1]. If haveFirst, out[0] is
+ * already known.
+ */
+{
+  AgmRun other(run);
+  AgmResult otherLeaf;
+  bool otherFirst;
   if (level<depth)
   {
-    ret=agmLattice(a,g,depth,level+1,branch);
-    while (branch.length()<level)
-      branch+='\0';
-    branch[level]^=0x80;
-    result=agm(a,g,branch);
-    otherSide=agmLattice(a,g,depth,level+1,result.branch);
-    for (i=0;i<otherSide.size();i++)
-      ret.push_back(otherSide[i]);
+    otherFirst=agmLatticeSplit(a,g,run,other,level,otherLeaf);
+    if (otherFirst)
+      out[(size_t)1<<(depth-level-1)]=otherLeaf.m;
+    agmLattice(a,g,run,depth,level+1,out,haveFirst);
+    agmLattice(a,g,other,depth,level+1,out+((size_t)1<<(depth-level-1)),otherFirst);
+  }
+  else if (!haveFirst)
+  {
+    run.finish();
+    *out=run.mean();
+  }
+}
+
+void agmLatticeTask(complex<double> a,complex<double> g,AgmRun run,unsigned depth,
+		    unsigned level,unsigned taskLevel,complex<double> *out,
+		    bool haveFirst,TaskGroup &group)
+/* Like agmLattice, but above taskLevel, each child is a separate task.
+ * Every subtree writes only its own part of out, so the result does not
+ * depend on which thread does what.
+ */
+{
+  AgmRun other(run);
+  AgmResult otherLeaf;
+  bool otherFirst;
+  if (level<taskLevel && level<depth)
+  {
+    otherFirst=agmLatticeSplit(a,g,run,other,level,otherLeaf);
+    if (otherFirst)
+      out[(size_t)1<<(depth-level-1)]=otherLeaf.m;
+    taskPool().run(group,[=,&group]()
+      {
+	agmLatticeTask(a,g,run,depth,level+1,taskLevel,out,haveFirst,group);
+      });
+    taskPool().run(group,[=,&group]()
+      {
+	agmLatticeTask(a,g,other,depth,level+1,taskLevel,
+		       out+((size_t)1<<(depth-level-1)),otherFirst,group);
+      });
   }
   else
+    agmLattice(a,g,run,depth,level,out,haveFirst);
+}
+
+vector<complex<double> > agmLattice(complex<double> a,complex<double> g,unsigned depth,unsigned level,AgmBranch branch)
+/* Returns the AGM on 2**(depth-level) branches, which agree with branch in
+ * the first level bytes (in their sign choices) and differ in the next
+ * depth-level bytes by having them turned halfway around or not. Each run
+ * of agm that leads to a node of the tree is resumed by both children.
+ */
+{
+  vector<complex<double> > ret;
+  AgmRun run(a,g,branch);
+  if (level<=depth)
   {
-    result=agm(a,g,branch);
-    ret.push_back(result.m);
+    ret.resize((size_t)1<<(depth-level));
+    run.advance(level);
+    agmLattice(a,g,run,depth,level,ret.data(),false);
   }
   return ret;
 }
 
-complex<double> pvAgm(complex<double> a,complex<double> g)
+void agmLattice(complex<double> a,complex<double> g,AgmRun &run,unsigned depth,
+		unsigned level,const AgmResult *first,const AgmLatticeVisitor &visit)
+/* Visits the leaves of run's subtree from left to right. If first is not
+ * null, it is the leftmost leaf, already computed. Only one run and one
+ * leaf per level are alive at a time.
+ */
 {
-  AgmResult res=agm(a,g,"");
-  return res.m;
+  AgmRun other(run);
+  AgmResult otherLeaf;
+  bool otherFirst;
+  if (level<depth)
+  {
+    otherFirst=agmLatticeSplit(a,g,run,other,level,otherLeaf);
+    agmLattice(a,g,run,depth,level+1,first,visit);
+    agmLattice(a,g,other,depth,level+1,otherFirst?&otherLeaf:nullptr,visit);
+  }
+  else if (first)
+    visit(first->m,first->branch);
+  else
+  {
+    run.finish();
+    visit(run.mean(),run.result);
+  }
 }
 
-array<complex<double>,2> invAgm1(complex<double> a,complex<double> g)
+void agmLattice(complex<double> a,complex<double> g,unsigned depth,unsigned level,
+		const AgmBranch &branch,const AgmLatticeVisitor &visit)
+/* Calls visit with each leaf of the same tree as the other agmLattice, in
+ * the same order, and the branch it took, as soon as it is computed.
+ * Memory is proportional to depth, not 2**depth, so it can go deeper than
+ * will fit in a vector.
+ */
+{
+  AgmRun run(a,g,branch);
+  if (level<=depth)
+  {
+    run.advance(level);
+    agmLattice(a,g,run,depth,level,nullptr,visit);
+  }
+}
+
+double agmBound(const AgmRun &run)
+/* Every later a and g of run, whatever square roots are taken, is no bigger
+ * than (abs(a)+abs(g))/2 now, since the arithmetic mean and the geometric
+ * mean both are. If run is done, the mean can also be g now. Once g is 0,
+ * it stays 0, and so does the mean. The bound is increased a little to allow
+ * for roundoff.
+ */
+{
+  double bound=(abs(run.out.a)+abs(run.out.g))/2;
+  if (run.out.g==0.)
+    bound=0;
+  if (run.done)
+    bound=max(bound,abs(run.out.g));
+  return bound*(1+agmBoundSlack);
+}
+
+void agmEnumerate(complex<double> a,complex<double> g,AgmRun &run,unsigned depth,
+		  unsigned level,const AgmResult *first,double threshold,
+		  const AgmLatticeVisitor &visit)
+{
+  AgmRun other(run);
+  AgmResult otherLeaf;
+  bool otherFirst;
+  if (agmBound(run)>=threshold)
+  {
+    if (level<depth)
+    {
+      otherFirst=agmLatticeSplit(a,g,run,other,level,otherLeaf);
+      agmEnumerate(a,g,run,depth,level+1,first,threshold,visit);
+      agmEnumerate(a,g,other,depth,level+1,otherFirst?&otherLeaf:nullptr,threshold,visit);
+    }
+    else if (first)
+    {
+      if (abs(first->m)>=threshold)
+	visit(first->m,first->branch);
+    }
+    else
+    {
+      run.finish();
+      if (abs(run.mean())>=threshold)
+	visit(run.mean(),run.result);
+    }
+  }
+}
+
+void agmEnumerate(complex<double> a,complex<double> g,double threshold,unsigned depth,
+		  const AgmLatticeVisitor &visit)
+/* Visits the leaves of agmLattice(a,g,depth) whose absolute value is at
+ * least threshold, in the same order. Each flipped sign shrinks abs(a)+abs(g)
+ * by at least 14%, so most subtrees are cut off after a few steps without
+ * being computed, and depth can be much greater than agmLattice can handle.
+ */
+{
+  AgmRun run(a,g,AgmBranch());
+  agmEnumerate(a,g,run,depth,0,nullptr,threshold,visit);
+}
+
+vector<complex<double> > agmLatticeParallel(complex<double> a,complex<double> g,unsigned depth,unsigned level,AgmBranch branch)
+/* Same as agmLattice, computed on the task pool. The top levels of the tree
+ * are split into about 16 tasks per thread; below that, each task computes
+ * its subtree serially.
+ */
+{
+  vector<complex<double> > ret;
+  AgmRun run(a,g,branch);
+  TaskGroup group;
+  unsigned taskLevel=level+4;
+  while (((size_t)1<<(taskLevel-level))<16*taskPool().size())
+    taskLevel++;
+  if (level<=depth)
+  {
+    ret.resize((size_t)1<<(depth-level));
+    run.advance(level);
+    agmLatticeTask(a,g,run,depth,level,taskLevel,ret.data(),false,group);
+    taskPool().wait(group);
+  }
+  return ret;
+}
+
+template<typename T> array<complex<T>,2> invAgm1(complex<T> a,complex<T> g)
 /* Returns two numbers whose arithmetic mean is a and geometric mean is g.
  * You are responsible for swapping them if necessary.
  */
 {
-  complex<double> diffsq=(a+g)*(a-g); // a*a-g*g is imprecise if a is close to g
-  complex<double> rt=sqrt(diffsq);
-  array<complex<double>,2> ret;
+  complex<T> diffsq=(a+g)*(a-g); // a*a-g*g is imprecise if a is close to g
+  complex<T> rt=sqrt(diffsq);
+  array<complex<T>,2> ret;
   if (abs(a-rt)>abs(a+rt))
     rt=-rt;
   ret[0]=a+rt;
-  if (abs(a+rt)>2*abs(a-rt))
+  if (abs(a+rt)>T(2)*abs(a-rt))
     ret[1]=g*g/ret[0];
   else
     ret[1]=a-rt;
   return ret;
 }
+
+array<complex<double>,2> invAgm1(complex<double> a,complex<double> g)
+{
+  return invAgm1<double>(a,g);
+}
+
+/* invAgm1Batch does invAgm1 on n pairs of numbers, writing ret[0] to out0
+ * and ret[1] to out1. The lanes compare squared norms instead of calling
+ * hypot, take the square root as glibc's csqrt does, and divide by Smith's
+ * method as libgcc's complex division does; its scaling is by powers of 2,
+ * which does not change the quotient of numbers in range. So the results are
+ * the same bits as invAgm1's. The squared norms are within 2 ulps of the
+ * square of abs, so they can decide a comparison differently only when the
+ * two sides are within invAgmTieMargin of each other; such lanes, and lanes
+ * out of range, are done by invAgm1.
+ */
+
+const double invAgmTieMargin=0x1p-48;
+
+struct InvAgmLanes
+{
+  double ar[agmBatchBlock],ai[agmBatchBlock],gr[agmBatchBlock],gi[agmBatchBlock];
+  double xr[agmBatchBlock],xi[agmBatchBlock],yr[agmBatchBlock],yi[agmBatchBlock];
+  bool scalar[agmBatchBlock];
+};
+
+inline bool invAgmNear(double x,double y)
+{
+  return fabs(x-y)<=invAgmTieMargin*(x+y);
+}
+
+inline bool invAgm1Lane(double ar,double ai,double gr,double gi,double &xr,double &xi,double &yr,double &yi)
+/* Sets x and y to invAgm1(a,g). Returns true if the lane must be redone
+ * by invAgm1. There are no branches, so a loop over lanes vectorizes.
+ */
+{
+  double sr,si,dr,di,qr,qi,rr,ri,pr,pi,mr,mi,np,nm,nx,ny,nr,ni,c,d,ratio,denom,qxr,qxi,qyr,qyi;
+  bool inRange,tie0,tie1,flip,useG,cSmall;
+  sr=ar+gr;
+  si=ai+gi;
+  dr=ar-gr;
+  di=ai-gi;
+  qr=sr*dr-si*di;
+  qi=sr*di+si*dr;
+  inRange=agmBatchInRange(ar,ai) & agmBatchInRange(gr,gi) & agmBatchInRange(qr,qi);
+  laneSqrt(qr,qi,rr,ri);
+  pr=ar+rr;
+  pi=ai+ri;
+  mr=ar-rr;
+  mi=ai-ri;
+  np=pr*pr+pi*pi;
+  nm=mr*mr+mi*mi;
+  tie0=invAgmNear(nm,np);
+  flip=nm>np; // a+(-rt) is the same as a-rt
+  xr=flip?mr:pr;
+  xi=flip?mi:pi;
+  yr=flip?pr:mr;
+  yi=flip?pi:mi;
+  nx=flip?nm:np;
+  ny=flip?np:nm;
+  tie1=invAgmNear(nx,4*ny);
+  useG=nx>4*ny;
+  nr=gr*gr-gi*gi;
+  ni=gr*gi+gi*gr;
+  c=xr;
+  d=xi;
+  cSmall=fabs(c)<fabs(d);
+  ratio=cSmall?c/d:d/c;
+  denom=cSmall?c*ratio+d:d*ratio+c;
+  qxr=cSmall?(nr*ratio+ni)/denom:(ni*ratio+nr)/denom;
+  qxi=cSmall?(ni*ratio-nr)/denom:(ni-nr*ratio)/denom;
+  qyr=useG?qxr:yr;
+  qyi=useG?qxi:yi;
+  yr=qyr;
+  yi=qyi;
+  return !inRange | tie0 | tie1;
+}
+
+void invAgm1Batch(const complex<double> *a,const complex<double> *g,complex<double> *out0,complex<double> *out1,size_t n)
+{
+  InvAgmLanes l;
+  size_t base,k,live;
+  array<complex<double>,2> ret;
+  for (base=0;base<n;base+=agmBatchBlock)
+  {
+    live=min(n-base,(size_t)agmBatchBlock);
+    for (k=0;k<live;k++)
+    {
+      l.ar[k]=a[base+k].real();
+      l.ai[k]=a[base+k].imag();
+      l.gr[k]=g[base+k].real();
+      l.gi[k]=g[base+k].imag();
+    }
+    for (k=0;k<live;k++)
+      l.scalar[k]=invAgm1Lane(l.ar[k],l.ai[k],l.gr[k],l.gi[k],l.xr[k],l.xi[k],l.yr[k],l.yi[k]);
+    for (k=0;k<live;k++)
+    {
+      out0[base+k]=complex<double>(l.xr[k],l.xi[k]);
+      out1[base+k]=complex<double>(l.yr[k],l.yi[k]);
+    }
+    for (k=0;k<live;k++)
+      if (l.scalar[k])
+      {
+	ret=invAgm1(a[base+k],g[base+k]);
+	out0[base+k]=ret[0];
+	out1[base+k]=ret[1];
+      }
+  }
+}
+
+/* agmBatch computes the principal AGM of n pairs of numbers, given as separate
+ * arrays of real and imaginary parts, and writes the means to mre and mim.
+ * If branch is not null, it writes the branch of lane i, as agm would return
+ * it, to branch[i].
+ *
+ * The lanes are processed in blocks. Each iteration runs agm1 with d=0 on all
+ * live lanes of the block in straight-line code that the compiler can
+ * vectorize. The complex square root is done as glibc's csqrt does it, with
+ * glibc's hypot kernel, so the means and branches are the same as agm's,
+ * provided the compiler does not fuse multiplies and adds. The sign of g is
+ * chosen by the sign of Re(a*conj(g)), which is the same test as
+ * abs(a-g)>abs(a+g). A lane that converges is retired by moving the last live
+ * lane into its place, so the block shrinks instead of waiting on the slowest
+ * lane. Lanes whose inputs are too big or small for the hypot kernel to work
+ * without scaling are done by agm.
+ *
+ * agmBatch is instantiated for float and double. glibc's hypotf is the
+ * square root, in double, of the sum of squares, so float lanes do that,
+ * and float's blocks are twice as wide in vector registers.
+ */
+
+template<typename T> struct AgmLanes
+{
+  T ar[agmBatchBlock],ai[agmBatchBlock],gr[agmBatchBlock],gi[agmBatchBlock];
+  T par[agmBatchBlock],pai[agmBatchBlock],pgr[agmBatchBlock],pgi[agmBatchBlock];
+  bool done[agmBatchBlock];
+  size_t lane[agmBatchBlock];
+};
+
+template<typename T> void agmBatchStep(AgmLanes<T> &l,int live)
+/* Does one iteration of agm1, with d=0, on lanes 0 through live-1. A lane
+ * is also done if the step returns to the a and g before the last, as
+ * AgmRun stops, so that a lane caught in a two-step cycle ends as agm does.
+ */
+{
+  int k;
+  T oar,oai,ogr,ogi;
+  bool done;
+  for (k=0;k<live;k++)
+  {
+    oar=l.ar[k];
+    oai=l.ai[k];
+    ogr=l.gr[k];
+    ogi=l.gi[k];
+    done=agmLaneStep(l.ar[k],l.ai[k],l.gr[k],l.gi[k]);
+    l.done[k]=done | ((l.ar[k]==l.par[k]) & (l.ai[k]==l.pai[k]) & (l.gr[k]==l.pgr[k]) & (l.gi[k]==l.pgi[k]));
+    l.par[k]=oar;
+    l.pai[k]=oai;
+    l.pgr[k]=ogr;
+    l.pgi[k]=ogi;
+  }
+}
+
+template<typename T> void agmBatch(const T *are,const T *aim,const T *gre,const T *gim,
+				   T *mre,T *mim,AgmBranch *branch,size_t n)
+{
+  AgmLanes<T> l;
+  AgmResultT<T> res;
+  size_t start,i;
+  int live,k,last,byte;
+  complex<T> am,gm;
+  for (start=0;start<n;start+=agmBatchBlock)
+  {
+    live=0;
+    for (i=start;i<n && i<start+agmBatchBlock;i++)
+      if (agmBatchInRange(are[i],aim[i]) && agmBatchInRange(gre[i],gim[i]))
+      {
+	l.par[live]=l.ar[live]=are[i];
+	l.pai[live]=l.ai[live]=aim[i];
+	l.pgr[live]=l.gr[live]=gre[i];
+	l.pgi[live]=l.gi[live]=gim[i];
+	l.lane[live]=i;
+	if (branch)
+	  branch[i].clear();
+	live++;
+      }
+      else
+      {
+	res=agm(complex<T>(are[i],aim[i]),complex<T>(gre[i],gim[i]));
+	mre[i]=res.m.real();
+	mim[i]=res.m.imag();
+	if (branch)
+	  branch[i]=res.branch;
+      }
+    while (live)
+    {
+      agmBatchStep(l,live);
+      if (branch)
+	for (k=0;k<live;k++)
+	{
+	  am=complex<T>(l.ar[k],l.ai[k]);
+	  gm=complex<T>(l.gr[k],l.gi[k]);
+	  if constexpr (is_same<T,double>::value)
+	    byte=agmByte(gm,am);
+	  else
+	    byte=256;
+	  if (byte>255)
+	    byte=(argi(complexDouble(gm/am))+0x400000)>>23;
+	  branch[l.lane[k]]+=(char)byte;
+	}
+      for (k=0;k<live;)
+	if (l.done[k])
+	{
+	  i=l.lane[k];
+	  mre[i]=l.gr[k];
+	  mim[i]=l.gi[k];
+	  last=--live;
+	  l.ar[k]=l.ar[last];
+	  l.ai[k]=l.ai[last];
+	  l.gr[k]=l.gr[last];
+	  l.gi[k]=l.gi[last];
+	  l.par[k]=l.par[last];
+	  l.pai[k]=l.pai[last];
+	  l.pgr[k]=l.pgr[last];
+	  l.pgi[k]=l.pgi[last];
+	  l.done[k]=l.done[last];
+	  l.lane[k]=l.lane[last];
+	}
+	else
+	  k++;
+    }
+  }
+}
+
+void agmBatch(const double *are,const double *aim,const double *gre,const double *gim,
+	      double *mre,double *mim,AgmBranch *branch,size_t n)
+{
+  agmBatch<double>(are,aim,gre,gim,mre,mim,branch,n);
+}
+
+/* If a and g are real and neither is negative, every step of agm multiplies
+ * and adds reals, glibc's csqrt of a positive real is sqrt, and every byte
+ * of the branch is 0, so the principal AGM can be computed in real numbers
+ * and comes out the same. If both are negative or zero, every step is the
+ * negative of the one for -a and -g.
+ */
+
+double pvAgmReal(double a,double g)
+// a and g are finite and not negative.
+{
+  double pa=a,pg=g,na,ng;
+  while (true)
+  {
+    na=(a+g)/2;
+    ng=sqrt(a*g);
+    if (na==ng || ng==0 || (na==a && ng==g) || (na==pa && ng==pg))
+      return ng;
+    pa=a;
+    pg=g;
+    a=na;
+    g=ng;
+  }
+}
+
+int pvAgmRealSign(complex<double> a,complex<double> g)
+/* Returns 1 if pvAgmReal can do a and g, -1 if it can do -a and -g,
+ * else 0.
+ */
+{
+  int ret=0;
+  if (a.imag()==0 && g.imag()==0 && isfinite(a.real()) && isfinite(g.real()))
+  {
+    if (a.real()>=0 && g.real()>=0)
+      ret=1;
+    else if (a.real()<=0 && g.real()<=0)
+      ret=-1;
+  }
+  return ret;
+}
+
+complex<double> pvAgm(complex<double> a,complex<double> g)
+{
+  AgmResult res;
+  int sign=pvAgmRealSign(a,g);
+  if (sign)
+    res.m=sign*pvAgmReal(sign*a.real(),sign*g.real());
+  else
+    res=agm(a,g);
+  return res.m;
+}
+
+struct AgmRealLanes
+{
+  double a[agmBatchBlock],g[agmBatchBlock],pa[agmBatchBlock],pg[agmBatchBlock];
+  double sign[agmBatchBlock];
+  bool done[agmBatchBlock];
+  size_t lane[agmBatchBlock];
+};
+
+void pvAgmBatchStep(AgmRealLanes &l,int live)
+{
+  int k;
+  double na,ng;
+  for (k=0;k<live;k++)
+  {
+    na=(l.a[k]+l.g[k])/2;
+    ng=sqrt(l.a[k]*l.g[k]);
+    l.done[k]=na==ng || ng==0 || (na==l.a[k] && ng==l.g[k]) || (na==l.pa[k] && ng==l.pg[k]);
+    l.pa[k]=l.a[k];
+    l.pg[k]=l.g[k];
+    l.a[k]=na;
+    l.g[k]=ng;
+  }
+}
+
+void pvAgmBatch(const double *a,const double *g,double *mre,double *mim,size_t n)
+/* Computes pvAgm of n pairs of reals. The lanes that pvAgmReal can do are
+ * done in blocks, like agmBatch, in a loop that the compiler can vectorize;
+ * pairs with opposite signs, whose mean is complex, are done by agm.
+ */
+{
+  AgmRealLanes l;
+  complex<double> m;
+  size_t start,i;
+  int live,k,last,sign;
+  for (start=0;start<n;start+=agmBatchBlock)
+  {
+    live=0;
+    for (i=start;i<n && i<start+agmBatchBlock;i++)
+    {
+      sign=pvAgmRealSign(a[i],g[i]);
+      if (sign)
+      {
+	l.pa[live]=l.a[live]=sign*a[i];
+	l.pg[live]=l.g[live]=sign*g[i];
+	l.sign[live]=sign;
+	l.lane[live]=i;
+	mim[i]=0;
+	live++;
+      }
+      else
+      {
+	m=agm(a[i],g[i]).m;
+	mre[i]=m.real();
+	mim[i]=m.imag();
+      }
+    }
+    while (live)
+    {
+      pvAgmBatchStep(l,live);
+      for (k=0;k<live;)
+	if (l.done[k])
+	{
+	  mre[l.lane[k]]=l.sign[k]*l.g[k];
+	  last=--live;
+	  l.a[k]=l.a[last];
+	  l.g[k]=l.g[last];
+	  l.pa[k]=l.pa[last];
+	  l.pg[k]=l.pg[last];
+	  l.sign[k]=l.sign[last];
+	  l.done[k]=l.done[last];
+	  l.lane[k]=l.lane[last];
+	}
+	else
+	  k++;
+    }
+  }
+}
+
+template AgmRecT<float> agm1(AgmRecT<float> ag);
+template AgmRecT<double> agm1(AgmRecT<double> ag);
+template AgmRecT<long double> agm1(AgmRecT<long double> ag);
+template AgmRecT<DoubleDouble> agm1(AgmRecT<DoubleDouble> ag);
+template AgmResultT<float> agm(complex<float> a,complex<float> g,const AgmBranch &branch);
+template AgmResultT<double> agm(complex<double> a,complex<double> g,const AgmBranch &branch);
+template AgmResultT<long double> agm(complex<long double> a,complex<long double> g,const AgmBranch &branch);
+template AgmResultT<DoubleDouble> agm(complex<DoubleDouble> a,complex<DoubleDouble> g,const AgmBranch &branch);
+template array<complex<float>,2> invAgm1(complex<float> a,complex<float> g);
+template array<complex<double>,2> invAgm1(complex<double> a,complex<double> g);
+template array<complex<long double>,2> invAgm1(complex<long double> a,complex<long double> g);
+template array<complex<DoubleDouble>,2> invAgm1(complex<DoubleDouble> a,complex<DoubleDouble> g);
+template void agmBatch(const float *are,const float *aim,const float *gre,const float *gim,
+		       float *mre,float *mim,AgmBranch *branch,size_t n);
+template void agmBatch(const double *are,const double *aim,const double *gre,const double *gim,
+		       double *mre,double *mim,AgmBranch *branch,size_t n);
@@ -8,26 +8,141 @@
  * This file is part of AGM.
  */
 
+#ifndef AGM_H
+#define AGM_H
+
 #include <cmath>
+#include <cstdint>
 #include <complex>
 #include <string>
 #include <vector>
 #include <array>
+#include <functional>
+#include "doubledouble.h"
+
+/* The AGM engine is a template on the type of the real and imaginary parts,
+ * and is instantiated for float, double, long double, and DoubleDouble.
+ * Double has also plain functions, which agm, agmLattice, and the rest use;
+ * they are faster, and give the same results as the templates.
+ */
 
-struct AgmRec
+template<typename T> struct AgmRecT
 {
-  std::complex<double> a,g;
+  std::complex<T> a,g;
   int32_t d;
 };
 
-struct AgmResult
+typedef AgmRecT<double> AgmRec;
+
+class AgmBranch
+/* A branch of the AGM, as a string of bytes (see agm.cpp). The first
+ * inlineDepth bytes are kept in the object; only a branch longer than
+ * that, which takes more iterations than any lattice we draw, spills the
+ * rest into a string on the heap. It converts to and from std::string
+ * with the same bytes.
+ */
+{
+public:
+  static const unsigned inlineDepth=60;
+  AgmBranch()
+  {
+    len=0;
+  }
+  AgmBranch(const std::string &str);
+  AgmBranch(const char *str);
+  operator std::string() const;
+  size_t length() const
+  {
+    return len;
+  }
+  bool empty() const
+  {
+    return len==0;
+  }
+  char operator[](size_t i) const
+  {
+    return (i<inlineDepth)?bytes[i]:spill[i-inlineDepth];
+  }
+  char &operator[](size_t i)
+  {
+    return (i<inlineDepth)?bytes[i]:spill[i-inlineDepth];
+  }
+  void push_back(char c)
+  {
+    if (len<inlineDepth)
+      bytes[len]=c;
+    else
+      spill+=c;
+    len++;
+  }
+  AgmBranch &operator+=(char c)
+  {
+    push_back(c);
+    return *this;
+  }
+  void resize(size_t n,char c='\0');
+  void clear();
+  size_t trimmedLength() const;
+private:
+  uint32_t len;
+  char bytes[inlineDepth];
+  std::string spill;
+};
+
+template<typename T> struct AgmResultT
 {
-  std::complex<double> m;
-  std::string branch;
+  std::complex<T> m;
+  AgmBranch branch;
 };
 
+typedef AgmResultT<double> AgmResult;
+
+const unsigned agmMaxIterations=64;
+
+class AgmRun
+/* agm partway through its iterations. i steps have been done, using the
+ * first i bytes of branch; done is set when agm would stop. Runs that share
+ * a prefix of their branches share their first steps, so agmLattice copies
+ * a run and resumes it instead of starting over.
+ */
+{
+public:
+  AgmRun(std::complex<double> a,std::complex<double> g,const AgmBranch &br);
+  void step();
+  void advance(unsigned steps);
+  void finish();
+  bool rebranch(const AgmBranch &br);
+  std::complex<double> mean()
+  {
+    return out.g;
+  }
+  AgmRec prev,in,out;
+  AgmBranch branch,result;
+  unsigned n,i;
+  bool converged,done,consistent;
+};
+
+typedef std::function<void(std::complex<double>,const AgmBranch &)> AgmLatticeVisitor;
+
+template<typename T> AgmRecT<T> agm1(AgmRecT<T> ag);
+template<typename T> AgmResultT<T> agm(std::complex<T> a,std::complex<T> g=1,const AgmBranch &branch=AgmBranch());
+template<typename T> std::array<std::complex<T>,2> invAgm1(std::complex<T> a,std::complex<T> g);
+template<typename T> void agmBatch(const T *are,const T *aim,const T *gre,const T *gim,
+				   T *mre,T *mim,AgmBranch *branch,size_t n);
 AgmRec agm1(AgmRec ag);
-AgmResult agm(std::complex<double> a,std::complex<double> g=1,std::string branch="");
-std::vector<std::complex<double> > agmLattice(std::complex<double> a,std::complex<double> g=1,unsigned depth=0,unsigned level=0,std::string branch="");
+AgmRec agm1Byte(AgmRec ag);
+AgmResult agm(std::complex<double> a,std::complex<double> g=1,const AgmBranch &branch=AgmBranch());
+AgmResult agmTol(std::complex<double> a,std::complex<double> g,double tolerance,const AgmBranch &branch=AgmBranch(),
+		 unsigned *iterations=nullptr,unsigned maxIterations=agmMaxIterations);
+std::vector<std::complex<double> > agmLattice(std::complex<double> a,std::complex<double> g=1,unsigned depth=0,unsigned level=0,AgmBranch branch=AgmBranch());
+void agmLattice(std::complex<double> a,std::complex<double> g,unsigned depth,unsigned level,const AgmBranch &branch,const AgmLatticeVisitor &visit);
+void agmEnumerate(std::complex<double> a,std::complex<double> g,double threshold,unsigned depth,const AgmLatticeVisitor &visit);
+std::vector<std::complex<double> > agmLatticeParallel(std::complex<double> a,std::complex<double> g=1,unsigned depth=0,unsigned level=0,AgmBranch branch=AgmBranch());
 std::complex<double> pvAgm(std::complex<double> a,std::complex<double> g);
+void pvAgmBatch(const double *a,const double *g,double *mre,double *mim,size_t n);
 std::array<std::complex<double>,2> invAgm1(std::complex<double> a,std::complex<double> g);
+void invAgm1Batch(const std::complex<double> *a,const std::complex<double> *g,
+		  std::complex<double> *out0,std::complex<double> *out1,size_t n);
+void agmBatch(const double *are,const double *aim,const double *gre,const double *gim,
+	      double *mre,double *mim,AgmBranch *branch,size_t n);
+#endif
@@ -0,0 +1,105 @@
+/******************************************************/
+/*                                                    */
+/* agmlane.h - AGM steps in vectorizable lanes        */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#ifndef AGMLANE_H
+#define AGMLANE_H
+#include <cmath>
+#include <algorithm>
+
+/* These are the pieces of agmBatch that other batch computations built on
+ * the principal AGM share. They are inline so that a loop over lanes that
+ * calls them can be vectorized. GCC vectorizes such a loop only if sqrt
+ * need not set errno and the selects may be evaluated on both sides, so
+ * files that use them are compiled with -fno-math-errno and
+ * -fno-trapping-math, which change no results.
+ */
+
+const int agmBatchBlock=256;
+const double agmBatchMax=0x1p250,agmBatchMin=0x1p-250;
+const float agmBatchMaxFloat=0x1p30,agmBatchMinFloat=0x1p-30;
+
+inline bool agmBatchInRange(double re,double im)
+{
+  double x=std::fabs(re),y=std::fabs(im);
+  return (x<agmBatchMax) & (y<agmBatchMax) & ((x>agmBatchMin) | (y>agmBatchMin) | ((x==0) & (y==0)));
+}
+
+inline bool agmBatchInRange(float re,float im)
+{
+  float x=std::fabs(re),y=std::fabs(im);
+  return (x<agmBatchMaxFloat) & (y<agmBatchMaxFloat) & ((x>agmBatchMinFloat) | (y>agmBatchMinFloat) | ((x==0) & (y==0)));
+}
+
+inline float laneHypot(float x,float y)
+{
+  return std::sqrt((double)x*x+(double)y*y);
+}
+
+inline double laneHypot(double x,double y)
+/* This is the kernel of glibc's hypot without fused multiply-add,
+ * which gives the same result as hypot if nothing overflows or underflows.
+ */
+{
+  double ax=std::fabs(x),ay=std::fabs(y),big,small,h,delta,t1,t2;
+  big=(ax<ay)?ay:ax;
+  small=(ax<ay)?ax:ay;
+  h=std::sqrt(big*big+small*small);
+  delta=h-((h<=2*small)?small:big);
+  if (h<=2*small)
+  {
+    t1=big*(2*delta-big);
+    t2=(delta-2*(big-small))*delta;
+  }
+  else
+  {
+    t1=2*delta*(big-2*small);
+    t2=(4*delta-small)*small+delta*delta;
+  }
+  if (h==0)
+    return 0;
+  return h-(t1+t2)/(2*h);
+}
+
+template<typename T> inline void laneSqrt(T re,T im,T &r,T &s)
+/* Sets r+si to the square root of re+im*i as glibc's csqrt computes it,
+ * which it does if agmBatchInRange(re,im).
+ */
+{
+  T d,t,u;
+  d=laneHypot(re,im);
+  t=std::sqrt(T(0.5)*(d+std::fabs(re)));
+  u=(t==0)?0:T(0.5)*(im/t);
+  r=(re>0 || re==0)?t:std::fabs(u);
+  s=(re>0)?u:std::copysign(t,im);
+}
+
+template<typename T> inline bool agmLaneStep(T &ar,T &ai,T &gr,T &gi)
+/* Does one step of agm1, with d=0, on a and g, as glibc's csqrt would.
+ * Returns true if agm would stop. The tests are combined with & and |
+ * rather than && and ||, so that a loop over lanes has no branches.
+ */
+{
+  T nar,nai,ngr,ngi,pr,pi,r,s;
+  bool done;
+  nar=(ar+gr)/T(2);
+  nai=(ai+gi)/T(2);
+  pr=ar*gr-ai*gi;
+  pi=ar*gi+ai*gr;
+  laneSqrt(pr,pi,r,s);
+  ngr=(nar*r+nai*s<0)?-r:r;
+  ngi=(nar*r+nai*s<0)?-s:s;
+  done=((nar==ngr) & (nai==ngi)) | ((ngr==0) & (ngi==0)) |
+       ((nar==ar) & (nai==ai) & (ngr==gr) & (ngi==gi));
+  ar=nar;
+  ai=nai;
+  gr=ngr;
+  gi=ngi;
+  return done;
+}
+#endif
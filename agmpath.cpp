@@ -0,0 +1,88 @@
+/******************************************************/
+/*                                                    */
+/* agmpath.cpp - follow the AGM along a curve         */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#include <cmath>
+#include "agmpath.h"
+using namespace std;
+
+AgmPathTracker::AgmPathTracker(function<complex<double>(double)> p,complex<double> gm)
+{
+  path=p;
+  g=gm;
+  tolerance=1e-3;
+  minStep=1./64;
+  maxStep=16;
+  evaluations=0;
+  start(0);
+}
+
+void AgmPathTracker::start(double t0,const AgmBranch &branch)
+{
+  t=t0;
+  current=agm(path(t),g,branch);
+  evaluations++;
+  step=minStep;
+}
+
+vector<complex<double> > AgmPathTracker::track(double t1,vector<double> *params)
+/* Goes from t to t1 and returns the means along the way, starting with the
+ * current one. If params is not null, the values of t are put in it.
+ */
+{
+  vector<complex<double> > ret;
+  AgmResult mid,end;
+  double dir=(t1<t)?-1:1,h,err,factor;
+  bool last;
+  ret.push_back(current.m);
+  if (params)
+  {
+    params->clear();
+    params->push_back(t);
+  }
+  while (t!=t1)
+  {
+    h=step;
+    last=h>=fabs(t1-t);
+    if (last)
+      h=fabs(t1-t);
+    mid=agm(path(t+dir*h/2),g,current.branch);
+    end=agm(path(last?t1:t+dir*h),g,mid.branch);
+    evaluations+=2;
+    err=abs(mid.m-(current.m+end.m)/2.);
+    // The error is proportional to h², so the step that would just meet the
+    // tolerance is h*sqrt(tolerance/err).
+    if (err>0)
+      factor=0.9*sqrt(tolerance/err);
+    else
+      factor=2;
+    if (factor>2)
+      factor=2;
+    if (factor<0.25)
+      factor=0.25;
+    if (err<=tolerance || h<=minStep)
+    {
+      ret.push_back(mid.m);
+      ret.push_back(end.m);
+      if (params)
+      {
+	params->push_back(t+dir*h/2);
+	params->push_back(last?t1:t+dir*h);
+      }
+      t=last?t1:t+dir*h;
+      current=end;
+    }
+    if (!last || err>tolerance)
+      step=h*factor;
+    if (step<minStep)
+      step=minStep;
+    if (step>maxStep)
+      step=maxStep;
+  }
+  return ret;
+}
@@ -0,0 +1,38 @@
+/******************************************************/
+/*                                                    */
+/* agmpath.h - follow the AGM along a curve           */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#ifndef AGMPATH_H
+#define AGMPATH_H
+#include <functional>
+#include <vector>
+#include "agm.h"
+
+class AgmPathTracker
+/* Follows agm(path(t),g) continuously as t changes, passing the branch of
+ * each point to the next, like calling agm in a loop with a small step.
+ * The step is adjusted like that of an ODE solver: each step is done in
+ * two halves, and if the midpoint is farther than tolerance from the chord,
+ * the step is redone with a smaller one, and if it is much closer, the next
+ * step is bigger. A jump to another branch moves the midpoint off the chord,
+ * so near a branch point the step shrinks to minStep.
+ */
+{
+public:
+  AgmPathTracker(std::function<std::complex<double>(double)> p,std::complex<double> gm=1);
+  void start(double t0,const AgmBranch &branch=AgmBranch());
+  std::vector<std::complex<double> > track(double t1,std::vector<double> *params=nullptr);
+  AgmResult current;
+  double t,tolerance,minStep,maxStep;
+  unsigned evaluations;
+private:
+  std::function<std::complex<double>(double)> path;
+  std::complex<double> g;
+  double step;
+};
+#endif
@@ -0,0 +1,123 @@
+/******************************************************/
+/*                                                    */
+/* agmtable.cpp - interpolate agm(x,1) from a table   */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#include <cmath>
+#include "agm.h"
+#include "agmtable.h"
+using namespace std;
+
+double distanceToCut(complex<double> z)
+{
+  if (z.real()>=0)
+    return abs(z);
+  else
+    return fabs(z.imag());
+}
+
+AgmTable::AgmTable(complex<double> corner0,complex<double> corner1,int nx,int ny,double tol)
+{
+  int i,j;
+  lo=complex<double>(min(corner0.real(),corner1.real()),min(corner0.imag(),corner1.imag()));
+  dx=fabs(corner1.real()-corner0.real())/nx;
+  dy=fabs(corner1.imag()-corner0.imag())/ny;
+  this->nx=nx;
+  this->ny=ny;
+  tolerance=tol;
+  cells.resize(nx*ny);
+  for (j=0;j<ny;j++)
+    for (i=0;i<nx;i++)
+    {
+      cells[j*nx+i].center=lo+complex<double>((i+0.5)*dx,(j+0.5)*dy);
+      fit(cells[j*nx+i]);
+    }
+}
+
+void AgmTable::fit(AgmTableCell &cell)
+/* The samples are on a circle of radius up to six times the cell's
+ * half-diagonal r, but no closer to the cut than a tenth of the way from
+ * the center. Term k then shrinks like (r/R)**k, so terms are kept until
+ * the rest are below the tolerance, and checked at the corners and edges
+ * of the cell. Only the first half of the transform
+ * is used, since the second half is aliased.
+ */
+{
+  complex<double> samples[agmTableSamples],c[agmTableSamples/2],sum,x;
+  double r=hypot(dx,dy)/2,rad=min(0.9*distanceToCut(cell.center),6*r);
+  double tail,scale,err;
+  int j,k,deg;
+  cell.degree=-1;
+  if (rad<2*r)
+    return;
+  for (j=0;j<agmTableSamples;j++)
+    samples[j]=pvAgm(cell.center+polar(rad,2*M_PI*j/agmTableSamples),1);
+  for (k=0;k<agmTableSamples/2;k++)
+  {
+    sum=0;
+    for (j=0;j<agmTableSamples;j++)
+      sum+=samples[j]*polar(1.,-2*M_PI*j*k/agmTableSamples);
+    c[k]=sum/(double)agmTableSamples/pow(rad,k);
+  }
+  scale=abs(c[0]);
+  for (deg=agmTableSamples/2-1,tail=0;deg>0;deg--)
+  {
+    tail+=abs(c[deg])*pow(r,deg);
+    if (tail>tolerance*scale/4)
+      break;
+  }
+  if (deg==agmTableSamples/2-1)
+    return; // even the last term is too big
+  cell.degree=deg;
+  cell.start=coeffs.size();
+  for (k=0;k<=deg;k++)
+    coeffs.push_back(c[k]);
+  for (j=0;j<9;j++)
+  {
+    x=cell.center+complex<double>((j%3-1)*dx/2,(j/3-1)*dy/2);
+    err=abs(eval(cell,x)-pvAgm(x,1));
+    if (err>tolerance*abs(pvAgm(x,1)))
+    {
+      coeffs.resize(cell.start);
+      cell.degree=-1;
+      return;
+    }
+  }
+}
+
+complex<double> AgmTable::eval(const AgmTableCell &cell,complex<double> x) const
+{
+  complex<double> z=x-cell.center,sum=0;
+  int k;
+  for (k=cell.degree;k>=0;k--)
+    sum=sum*z+coeffs[cell.start+k];
+  return sum;
+}
+
+complex<double> AgmTable::operator()(complex<double> x) const
+{
+  double fx=(x.real()-lo.real())/dx,fy=(x.imag()-lo.imag())/dy;
+  int i,j;
+  if (fx>=0 && fx<nx && fy>=0 && fy<ny)
+  {
+    i=fx;
+    j=fy;
+    if (cells[j*nx+i].degree>=0)
+      return eval(cells[j*nx+i],x);
+  }
+  return pvAgm(x,1);
+}
+
+double AgmTable::coverage() const
+// Returns the fraction of the rectangle where the table is used.
+{
+  int i,n=0;
+  for (i=0;i<cells.size();i++)
+    if (cells[i].degree>=0)
+      n++;
+  return (double)n/cells.size();
+}
@@ -0,0 +1,50 @@
+/******************************************************/
+/*                                                    */
+/* agmtable.h - interpolate agm(x,1) from a table     */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#ifndef AGMTABLE_H
+#define AGMTABLE_H
+#include <complex>
+#include <vector>
+
+/* pvAgm(x,1) is analytic except on the negative real axis, where it has a
+ * cut from 0 (a logarithmic singularity) through -1 (where it is 0) to
+ * infinity. An AgmTable covers a rectangle with a grid of cells. For each
+ * cell, it computes the Taylor series of pvAgm(x,1) at its center from
+ * samples on a circle around it that stays clear of the cut (Cauchy's
+ * integral formula as a discrete Fourier transform), keeps as many terms as
+ * are needed for the tolerance, and checks the result against pvAgm on the
+ * boundary. A query in a good cell is a polynomial evaluation; one in a cell
+ * too close to the cut, or outside the rectangle, calls pvAgm.
+ */
+
+const int agmTableSamples=32;
+
+struct AgmTableCell
+{
+  std::complex<double> center;
+  int degree; // -1 if the cell falls back to pvAgm
+  size_t start;
+};
+
+class AgmTable
+{
+public:
+  AgmTable(std::complex<double> corner0,std::complex<double> corner1,int nx,int ny,double tol=1e-12);
+  std::complex<double> operator()(std::complex<double> x) const;
+  double coverage() const;
+private:
+  std::complex<double> lo;
+  double dx,dy,tolerance;
+  int nx,ny;
+  std::vector<AgmTableCell> cells;
+  std::vector<std::complex<double> > coeffs;
+  void fit(AgmTableCell &cell);
+  std::complex<double> eval(const AgmTableCell &cell,std::complex<double> x) const;
+};
+#endif
@@ -0,0 +1,165 @@
+/******************************************************/
+/*                                                    */
+/* doubledouble.cpp - numbers as sums of two doubles  */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#include <cmath>
+#include "doubledouble.h"
+using namespace std;
+
+/* The error-free transformations are Knuth's two-sum and Dekker's product,
+ * which splits each factor into two 26-bit halves. They do not use fused
+ * multiply-add, so they give the same answer on every machine, but they
+ * require that the compiler not fuse or reorder the operations.
+ */
+
+const double splitter=134217729; // 2**27+1
+
+void twoSum(double a,double b,double &s,double &e)
+{
+  double bb;
+  s=a+b;
+  bb=s-a;
+  e=(a-(s-bb))+(b-bb);
+}
+
+void quickTwoSum(double a,double b,double &s,double &e)
+// Requires abs(a)>=abs(b).
+{
+  s=a+b;
+  e=b-(s-a);
+}
+
+void split(double a,double &hi,double &lo)
+{
+  double t=splitter*a;
+  hi=t-(t-a);
+  lo=a-hi;
+}
+
+void twoProd(double a,double b,double &p,double &e)
+{
+  double ahi,alo,bhi,blo;
+  p=a*b;
+  split(a,ahi,alo);
+  split(b,bhi,blo);
+  e=((ahi*bhi-p)+ahi*blo+alo*bhi)+alo*blo;
+}
+
+DoubleDouble::DoubleDouble(double h,double l)
+{
+  quickTwoSum(h,l,hi,lo);
+}
+
+DoubleDouble operator+(const DoubleDouble &l,const DoubleDouble &r)
+{
+  double s,e,t,f;
+  twoSum(l.hi,r.hi,s,e);
+  twoSum(l.lo,r.lo,t,f);
+  e+=t;
+  quickTwoSum(s,e,s,e);
+  e+=f;
+  return DoubleDouble(s,e);
+}
+
+DoubleDouble operator-(const DoubleDouble &l,const DoubleDouble &r)
+{
+  return l+(-r);
+}
+
+DoubleDouble operator*(const DoubleDouble &l,const DoubleDouble &r)
+{
+  double p,e;
+  twoProd(l.hi,r.hi,p,e);
+  e+=l.hi*r.lo+l.lo*r.hi;
+  return DoubleDouble(p,e);
+}
+
+DoubleDouble operator/(const DoubleDouble &l,const DoubleDouble &r)
+/* Divides in double, then corrects the quotient twice by dividing the
+ * remainder.
+ */
+{
+  double q0,q1,q2;
+  DoubleDouble rem;
+  q0=l.hi/r.hi;
+  rem=l-r*q0;
+  q1=rem.hi/r.hi;
+  rem-=r*q1;
+  q2=rem.hi/r.hi;
+  return DoubleDouble(q0,q1)+q2;
+}
+
+DoubleDouble &DoubleDouble::operator+=(const DoubleDouble &r)
+{
+  return *this=*this+r;
+}
+
+DoubleDouble &DoubleDouble::operator-=(const DoubleDouble &r)
+{
+  return *this=*this-r;
+}
+
+DoubleDouble &DoubleDouble::operator*=(const DoubleDouble &r)
+{
+  return *this=*this*r;
+}
+
+DoubleDouble &DoubleDouble::operator/=(const DoubleDouble &r)
+{
+  return *this=*this/r;
+}
+
+bool operator==(const DoubleDouble &l,const DoubleDouble &r)
+{
+  return l.hi==r.hi && l.lo==r.lo;
+}
+
+bool operator!=(const DoubleDouble &l,const DoubleDouble &r)
+{
+  return !(l==r);
+}
+
+bool operator<(const DoubleDouble &l,const DoubleDouble &r)
+{
+  return l.hi<r.hi || (l.hi==r.hi && l.lo<r.lo);
+}
+
+bool operator>(const DoubleDouble &l,const DoubleDouble &r)
+{
+  return r<l;
+}
+
+bool operator<=(const DoubleDouble &l,const DoubleDouble &r)
+{
+  return !(r<l);
+}
+
+bool operator>=(const DoubleDouble &l,const DoubleDouble &r)
+{
+  return !(l<r);
+}
+
+DoubleDouble abs(const DoubleDouble &x)
+{
+  if (x.hi<0)
+    return -x;
+  else
+    return x;
+}
+
+DoubleDouble sqrt(const DoubleDouble &x)
+/* One step of Newton's method from the square root in double,
+ * which doubles the number of correct bits.
+ */
+{
+  double r;
+  if (x.hi<=0)
+    return DoubleDouble(std::sqrt(x.hi));
+  r=std::sqrt(x.hi);
+  return DoubleDouble(r)+(x-DoubleDouble(r)*r)/(2*r);
+}
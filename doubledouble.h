@@ -0,0 +1,86 @@
+/******************************************************/
+/*                                                    */
+/* doubledouble.h - numbers as sums of two doubles    */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#ifndef DOUBLEDOUBLE_H
+#define DOUBLEDOUBLE_H
+#include <complex>
+#include <cfloat>
+#include <limits>
+
+/* A DoubleDouble is hi+lo, where lo is no more than half an ulp of hi,
+ * giving about 106 bits of precision in the range of double. It is slow,
+ * and is meant for checking computations done in double. It has the
+ * operators and functions that std::complex needs to work on it.
+ */
+
+class DoubleDouble
+{
+public:
+  DoubleDouble()
+  {
+    hi=lo=0;
+  }
+  DoubleDouble(double x)
+  {
+    hi=x;
+    lo=0;
+  }
+  DoubleDouble(double h,double l);
+  explicit operator double() const
+  {
+    return hi;
+  }
+  DoubleDouble operator-() const
+  {
+    return DoubleDouble(-hi,-lo);
+  }
+  DoubleDouble &operator+=(const DoubleDouble &r);
+  DoubleDouble &operator-=(const DoubleDouble &r);
+  DoubleDouble &operator*=(const DoubleDouble &r);
+  DoubleDouble &operator/=(const DoubleDouble &r);
+  double hi,lo;
+};
+
+DoubleDouble operator+(const DoubleDouble &l,const DoubleDouble &r);
+DoubleDouble operator-(const DoubleDouble &l,const DoubleDouble &r);
+DoubleDouble operator*(const DoubleDouble &l,const DoubleDouble &r);
+DoubleDouble operator/(const DoubleDouble &l,const DoubleDouble &r);
+bool operator==(const DoubleDouble &l,const DoubleDouble &r);
+bool operator!=(const DoubleDouble &l,const DoubleDouble &r);
+bool operator<(const DoubleDouble &l,const DoubleDouble &r);
+bool operator>(const DoubleDouble &l,const DoubleDouble &r);
+bool operator<=(const DoubleDouble &l,const DoubleDouble &r);
+bool operator>=(const DoubleDouble &l,const DoubleDouble &r);
+DoubleDouble abs(const DoubleDouble &x);
+DoubleDouble sqrt(const DoubleDouble &x);
+
+/* The arithmetic is not rounded correctly, so is_iec559 is false, and
+ * iterations that stop when something stops changing should instead stop
+ * when it changes by a few epsilons.
+ */
+template<> class std::numeric_limits<DoubleDouble>
+{
+public:
+  static const bool is_specialized=true;
+  static const bool is_iec559=false;
+  static const int digits=106;
+  static DoubleDouble epsilon()
+  {
+    return 0x1p-104;
+  }
+  static DoubleDouble min()
+  {
+    return DBL_MIN;
+  }
+  static DoubleDouble max()
+  {
+    return DBL_MAX;
+  }
+};
+#endif
@@ -0,0 +1,220 @@
+/******************************************************/
+/*                                                    */
+/* elliptic.cpp - complete elliptic integrals         */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#include <cfloat>
+#include "agm.h"
+#include "agmlane.h"
+#include "taskpool.h"
+#include "elliptic.h"
+using namespace std;
+
+const size_t ellipticTaskSize=16*agmBatchBlock;
+const double ellipticTol=DBL_EPSILON*DBL_EPSILON;
+
+/* The AGM can end by drifting in the last bit for many steps, during which
+ * 2**n would overflow, so the iteration also stops when a and g are within
+ * an epsilon of each other. If k is ±1, K is infinite and E is 1.
+ */
+
+bool ellipticClose(double ar,double ai,double gr,double gi)
+{
+  return (ar-gr)*(ar-gr)+(ai-gi)*(ai-gi)<=ellipticTol*(ar*ar+ai*ai);
+}
+
+void ellipticKE(complex<double> k,complex<double> &K,complex<double> &E)
+{
+  complex<double> c,sum=k*k/2.;
+  double pow2=1;
+  AgmRun run(1,sqrt((1.-k)*(1.+k)),AgmBranch());
+  bool done=false;
+  while (!done)
+  {
+    c=(run.out.a-run.out.g)/2.;
+    sum+=pow2*(c*c);
+    pow2*=2;
+    run.step();
+    done=run.done || ellipticClose(run.out.a.real(),run.out.a.imag(),run.out.g.real(),run.out.g.imag());
+  }
+  if (run.out.g==0.)
+  {
+    K=INFINITY;
+    E=1;
+  }
+  else
+  {
+    K=M_PI/(2.*run.mean());
+    E=K*(1.-sum);
+  }
+}
+
+complex<double> ellipticK(complex<double> k)
+{
+  complex<double> K,E;
+  ellipticKE(k,K,E);
+  return K;
+}
+
+complex<double> ellipticE(complex<double> k)
+{
+  complex<double> K,E;
+  ellipticKE(k,K,E);
+  return E;
+}
+
+struct EllipticLanes
+{
+  double ar[agmBatchBlock],ai[agmBatchBlock],gr[agmBatchBlock],gi[agmBatchBlock];
+  double par[agmBatchBlock],pai[agmBatchBlock],pgr[agmBatchBlock],pgi[agmBatchBlock];
+  double sr[agmBatchBlock],si[agmBatchBlock],pow2[agmBatchBlock];
+  bool done[agmBatchBlock];
+  size_t lane[agmBatchBlock];
+};
+
+void ellipticStep(EllipticLanes &l,int live)
+/* Adds 2**(n-1)*c[n]² to the sum, then does a step of the AGM, in the same
+ * order of operations as ellipticKE on one number. A lane is done if agm
+ * would stop, if the step returns to the a and g before the last, as
+ * AgmRun stops, or if a and g are close. The loop has no branches; the
+ * finished lanes are taken out afterward, in ellipticBlocks.
+ */
+{
+  int k;
+  double cr,ci,oar,oai,ogr,ogi;
+  bool done;
+  for (k=0;k<live;k++)
+  {
+    cr=(l.ar[k]-l.gr[k])/2;
+    ci=(l.ai[k]-l.gi[k])/2;
+    l.sr[k]+=l.pow2[k]*(cr*cr-ci*ci);
+    l.si[k]+=l.pow2[k]*(cr*ci+ci*cr);
+    l.pow2[k]*=2;
+    oar=l.ar[k];
+    oai=l.ai[k];
+    ogr=l.gr[k];
+    ogi=l.gi[k];
+    done=agmLaneStep(l.ar[k],l.ai[k],l.gr[k],l.gi[k]);
+    done|=(l.ar[k]==l.par[k]) & (l.ai[k]==l.pai[k]) & (l.gr[k]==l.pgr[k]) & (l.gi[k]==l.pgi[k]);
+    l.par[k]=oar;
+    l.pai[k]=oai;
+    l.pgr[k]=ogr;
+    l.pgi[k]=ogi;
+    l.done[k]=done | ellipticClose(l.ar[k],l.ai[k],l.gr[k],l.gi[k]);
+  }
+}
+
+void ellipticBlocks(const double *kre,const double *kim,double *Kre,double *Kim,
+		    double *Ere,double *Eim,size_t begin,size_t end)
+{
+  EllipticLanes l;
+  size_t start,i;
+  int live,k,last;
+  complex<double> kk,kp,sum,K,E;
+  for (start=begin;start<end;start+=agmBatchBlock)
+  {
+    live=0;
+    for (i=start;i<end && i<start+agmBatchBlock;i++)
+    {
+      kk=complex<double>(kre[i],kim[i]);
+      kp=sqrt((1.-kk)*(1.+kk));
+      if (agmBatchInRange(kp.real(),kp.imag()) && agmBatchInRange(kre[i],kim[i]) && kp!=0.)
+      {
+	l.par[live]=l.ar[live]=1;
+	l.pai[live]=l.ai[live]=0;
+	l.pgr[live]=l.gr[live]=kp.real();
+	l.pgi[live]=l.gi[live]=kp.imag();
+	sum=kk*kk/2.;
+	l.sr[live]=sum.real();
+	l.si[live]=sum.imag();
+	l.pow2[live]=1;
+	l.lane[live]=i;
+	live++;
+      }
+      else
+      {
+	ellipticKE(kk,K,E);
+	if (Kre)
+	{
+	  Kre[i]=K.real();
+	  Kim[i]=K.imag();
+	}
+	if (Ere)
+	{
+	  Ere[i]=E.real();
+	  Eim[i]=E.imag();
+	}
+      }
+    }
+    while (live)
+    {
+      ellipticStep(l,live);
+      for (k=0;k<live;)
+	if (l.done[k])
+	{
+	  i=l.lane[k];
+	  K=M_PI/(2.*complex<double>(l.gr[k],l.gi[k]));
+	  E=K*(1.-complex<double>(l.sr[k],l.si[k]));
+	  if (Kre)
+	  {
+	    Kre[i]=K.real();
+	    Kim[i]=K.imag();
+	  }
+	  if (Ere)
+	  {
+	    Ere[i]=E.real();
+	    Eim[i]=E.imag();
+	  }
+	  last=--live;
+	  l.ar[k]=l.ar[last];
+	  l.ai[k]=l.ai[last];
+	  l.gr[k]=l.gr[last];
+	  l.gi[k]=l.gi[last];
+	  l.par[k]=l.par[last];
+	  l.pai[k]=l.pai[last];
+	  l.pgr[k]=l.pgr[last];
+	  l.pgi[k]=l.pgi[last];
+	  l.sr[k]=l.sr[last];
+	  l.si[k]=l.si[last];
+	  l.pow2[k]=l.pow2[last];
+	  l.done[k]=l.done[last];
+	  l.lane[k]=l.lane[last];
+	}
+	else
+	  k++;
+    }
+  }
+}
+
+void ellipticKE(const double *kre,const double *kim,double *Kre,double *Kim,
+		double *Ere,double *Eim,size_t n)
+/* Computes K, E, or both (the other pointers being null) of n moduli.
+ * The array is split into pieces of 16 blocks, which are done on the task
+ * pool; each block is done in lanes, like agmBatch, with the sum for E
+ * carried along in each lane. The results are the same as ellipticKE on
+ * each number.
+ */
+{
+  size_t start;
+  TaskGroup group;
+  for (start=0;start<n;start+=ellipticTaskSize)
+    taskPool().run(group,[=]()
+      {
+	ellipticBlocks(kre,kim,Kre,Kim,Ere,Eim,start,min(n,start+ellipticTaskSize));
+      });
+  taskPool().wait(group);
+}
+
+void ellipticK(const double *kre,const double *kim,double *Kre,double *Kim,size_t n)
+{
+  ellipticKE(kre,kim,Kre,Kim,nullptr,nullptr,n);
+}
+
+void ellipticE(const double *kre,const double *kim,double *Ere,double *Eim,size_t n)
+{
+  ellipticKE(kre,kim,nullptr,nullptr,Ere,Eim,n);
+}
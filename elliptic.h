@@ -0,0 +1,28 @@
+/******************************************************/
+/*                                                    */
+/* elliptic.h - complete elliptic integrals           */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#ifndef ELLIPTIC_H
+#define ELLIPTIC_H
+#include <complex>
+
+/* Complete elliptic integrals of the first and second kinds, K(k) and E(k),
+ * of complex modulus k, on the principal branch of the AGM:
+ * K=π/(2*agm(1,k')), where k'=sqrt(1-k²), and E=K*(1-Σ2**(n-1)*c[n]²),
+ * where c[0]=k and c[n+1]=(a[n]-g[n])/2. The batch forms take arrays of
+ * real and imaginary parts, like agmBatch.
+ */
+
+void ellipticKE(std::complex<double> k,std::complex<double> &K,std::complex<double> &E);
+std::complex<double> ellipticK(std::complex<double> k);
+std::complex<double> ellipticE(std::complex<double> k);
+void ellipticKE(const double *kre,const double *kim,double *Kre,double *Kim,
+		double *Ere,double *Eim,size_t n);
+void ellipticK(const double *kre,const double *kim,double *Kre,double *Kim,size_t n);
+void ellipticE(const double *kre,const double *kim,double *Ere,double *Eim,size_t n);
+#endif
@@ -0,0 +1,88 @@
+/******************************************************/
+/*                                                    */
+/* fourier.cpp - discrete Fourier transforms          */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#include <cassert>
+#include <cmath>
+#include "fourier.h"
+using namespace std;
+
+bool isPow2(size_t n)
+{
+  return n && (n&(n-1))==0;
+}
+
+void fft(Span<complex<double> > a,int sign)
+/* Iterative radix-2. The twiddle factors are computed directly for each
+ * stage's first half rather than by repeated multiplication, so the error
+ * doesn't grow with the length.
+ */
+{
+  size_t n=a.size(),i,j,k,len,half;
+  vector<complex<double> > twiddle;
+  complex<double> t;
+  assert(isPow2(n));
+  for (i=1,j=0;i<n;i++)
+  {
+    for (k=n>>1;j&k;k>>=1)
+      j^=k;
+    j|=k;
+    if (i<j)
+      swap(a[i],a[j]);
+  }
+  twiddle.resize(n/2);
+  for (i=0;i<n/2;i++)
+    twiddle[i]=polar(1.,sign*2*M_PI*i/n);
+  for (len=2;len<=n;len<<=1)
+  {
+    half=len/2;
+    for (i=0;i<n;i+=len)
+      for (j=0;j<half;j++)
+      {
+	t=a[i+j+half]*twiddle[j*(n/len)];
+	a[i+j+half]=a[i+j]-t;
+	a[i+j]+=t;
+      }
+  }
+}
+
+vector<complex<double> > dft(Span<const complex<double> > a,int sign)
+/* jk=(j²+k²-(k-j)²)/2, so the transform is a convolution of a times a
+ * chirp with the conjugate chirp. j² is reduced mod 2n before it becomes
+ * an angle, so the angle stays small.
+ */
+{
+  size_t n=a.size(),m,i;
+  vector<complex<double> > ret(a.begin(),a.end()),chirp,x,y;
+  if (isPow2(n))
+    fft(ret,sign);
+  else if (n>1)
+  {
+    for (m=1;m<2*n-1;m<<=1);
+    chirp.resize(n);
+    for (i=0;i<n;i++)
+      chirp[i]=polar(1.,sign*M_PI*((i*i)%(2*n))/n);
+    x.resize(m);
+    y.resize(m);
+    for (i=0;i<n;i++)
+    {
+      x[i]=a[i]*chirp[i];
+      y[i]=conj(chirp[i]);
+      if (i)
+	y[m-i]=y[i];
+    }
+    fft(x,-1);
+    fft(y,-1);
+    for (i=0;i<m;i++)
+      x[i]*=y[i];
+    fft(x,1);
+    for (i=0;i<n;i++)
+      ret[i]=x[i]*chirp[i]/(double)m;
+  }
+  return ret;
+}
@@ -0,0 +1,25 @@
+/******************************************************/
+/*                                                    */
+/* fourier.h - discrete Fourier transforms            */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#ifndef FOURIER_H
+#define FOURIER_H
+#include <complex>
+#include <vector>
+#include "span.h"
+
+/* Unnormalized transforms: out[k]=Σin[j]*exp(sign*2πijk/n), where sign is
+ * -1 for the forward transform and 1 for the inverse. fft works in place on
+ * a power-of-two length; dft takes any length, doing other lengths by
+ * Bluestein's chirp, which turns them into power-of-two convolutions.
+ */
+
+bool isPow2(size_t n);
+void fft(Span<std::complex<double> > a,int sign);
+std::vector<std::complex<double> > dft(Span<const std::complex<double> > a,int sign);
+#endif
@@ -31,9 +31,14 @@
 #include <iostream>
 #include <cfloat>
 #include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <queue>
 #include "agm.h"
 #include "khe.h"
 #include "pairwisesum.h"
+#include "taskpool.h"
+#include "fourier.h"
 using namespace std;
 
 #if ULPRAD==65
@@ -84,14 +89,26 @@ const double a65[]=
 };
 #endif
 
-int mostInnings=0;
+atomic<int> mostInnings(0);
+const int kheExpandChunk=16384;
+const int kheMemoBits=6;
+const int kheLaneBlock=256;
+const double kheSpectrumTol=1e-10;
+atomic<uint64_t> lastKheId(0);
 
-map<double,vector<vector<complex<double> > > > loopCache;
-/* The key is the circle center used to make the 65-ulp loop, which loops
- * must be divided by when fetching them from cache. The value is a sequence
- * of loops, the 0th being the 65-ulp loop with 36 points, and each successive
- * loop having twice as many points.
+struct KheMemo
+{
+  uint64_t kheId;
+  double x,center;
+  int nExpand;
+  weak_ptr<KheLoopSet> set;
+};
+
+/* Each thread remembers the loops it last looked up, for up to 64 real
+ * parts, so that a raster, which evaluates many points with the same
+ * real part, skips the map.
  */
+thread_local KheMemo kheMemo[1<<kheMemoBits];
 
 unsigned gcd(unsigned a,unsigned b)
 {
@@ -108,7 +125,7 @@ unsigned gcd(unsigned a,unsigned b)
   return a+b;
 }
 
-KheSwapStep::KheSwapStep(int n,int d,vector<complex<double> > &loop)
+KheSwapStep::KheSwapStep(int n,int d,Span<complex<double> > loop)
 /* loop[a] and loop[b] are both real, in which case loop[a] should be near
  * loop[0]/k where k is in [1,-3,5,-7,...], or loop[a] and loop[b] are
  * both imaginary, in which case loop[a] should have positive imaginary part.
@@ -128,7 +145,7 @@ KheSwapStep::KheSwapStep(int n,int d,vector<complex<double> > &loop)
   lastDiff=loop[a]-loop[b];
 }
 
-void KheSwapStep::step(vector<complex<double> > &loop)
+void KheSwapStep::step(Span<complex<double> > loop)
 {
   a+=dir;
   b+=dir;
@@ -143,7 +160,7 @@ void KheSwapStep::step(vector<complex<double> > &loop)
   dist=abs(loop[a]-loop[b]);
 }
 
-void KheSwapStep::swap(vector<complex<double> > &loop)
+void KheSwapStep::swap(Span<complex<double> > loop)
 {
   if (real((loop[a]-loop[b])/lastDiff)<0)
     ::swap(loop[a],loop[b]);
@@ -166,44 +183,85 @@ bool meet(KheSwapStep &n,KheSwapStep &s)
   return n.dir!=s.dir && (n.a==s.a || n.a==s.b);
 }
 
-void findMeeters(vector<KheSwapStep *> &swapStep)
+int meetKey(const KheSwapStep &s)
+{
+  if (s.a>s.b || (s.a==0 && s.dir<0))
+    return s.b;
+  else
+    return s.a;
+}
+
+void findMeeters(vector<KheSwapStep> &swapStep)
 /* Arrange the steppers in order of a or b, whichever is less, except that
  * the stepper with a=0 going backward is placed at the end. This puts
- * steppers that will meet in pairs. A quadratic sort is fast enough, as
- * the loop is much bigger than the set of steppers;
+ * steppers that will meet in pairs. The sort is stable, so steppers that
+ * tie stay in the order they were made.
  */
 {
-  int i,j,a0,a1,sz=swapStep.size();
-  for (i=0;i<sz-1;i++)
-    for (j=0;j<sz-1;j++)
+  int i,sz=swapStep.size();
+  stable_sort(swapStep.begin(),swapStep.end(),[](const KheSwapStep &x,const KheSwapStep &y)
     {
-      a0=swapStep[j]->a;
-      if (a0>swapStep[j]->b || (a0==0 && swapStep[j]->dir<0))
-	a0=swapStep[j]->b;
-      a1=swapStep[j+1]->a;
-      if (a1>swapStep[j+1]->b || (a1==0 && swapStep[j+1]->dir<0))
-	a1=swapStep[j+1]->b;
-      if (a0>a1 || (a0==a1 && swapStep[j]->dir>swapStep[j+1]->dir))
-	swap(swapStep[j],swapStep[j+1]);
-    }
+      int kx=meetKey(x),ky=meetKey(y);
+      return kx<ky || (kx==ky && x.dir<y.dir);
+    });
   for (i=0;i<sz;i++)
-    swapStep[i]->partner=swapStep[i^1];
+    swapStep[i].partner=&swapStep[i^1];
 }
 
-void sortSteppers(vector<KheSwapStep *> &swapStep)
-/* Arrange the steppers in order of increasing distance.
+struct KheStepEntry
+{
+  double dist;
+  uint64_t stamp;
+  int inx;
+};
+
+bool operator<(const KheStepEntry &a,const KheStepEntry &b)
+{
+  return a.dist<b.dist || (a.dist==b.dist && a.stamp<b.stamp);
+}
+
+void runSteppers(KheSwapStep *swapStep,int n,Span<complex<double> > loop)
+/* Runs the n steppers, which are in pairs as findMeeters leaves them, always
+ * stepping the one with the greatest distance, until each pair meets.
+ * Of steppers at the same distance, the one that stepped last goes first,
+ * and of those that haven't stepped, the one that comes later in swapStep;
+ * the stamp keeps track of this. Pairs touch disjoint arcs of the loop, and
+ * when partners are tied in distance, the order in which they step depends
+ * only on the pair, so running any set of whole pairs by itself does the
+ * same as running them all together.
+ *
+ * When a pair meets, its other stepper's entry is left in the heap and
+ * dropped when it comes to the top.
  */
 {
-  int i,j,sz=swapStep.size();
-  for (i=0;i<sz-1;i++)
-    for (j=0;j<sz-1;j++)
+  vector<KheStepEntry> entries;
+  vector<bool> met(n,false);
+  KheStepEntry top;
+  uint64_t stamp;
+  int partner;
+  for (stamp=0;stamp<n;stamp++)
+    entries.push_back(KheStepEntry{swapStep[stamp].dist,stamp,(int)stamp});
+  priority_queue<KheStepEntry> heap(less<KheStepEntry>(),move(entries));
+  while (heap.size())
+  {
+    top=heap.top();
+    heap.pop();
+    if (met[top.inx])
+      continue;
+    KheSwapStep &step=swapStep[top.inx];
+    step.step(loop);
+    step.swap(loop);
+    if (meet(step,*step.partner))
     {
-      if (*swapStep[j]>*swapStep[j+1])
-	swap(swapStep[j],swapStep[j+1]);
+      partner=step.partner-swapStep;
+      met[top.inx]=met[partner]=true;
     }
+    else
+      heap.push(KheStepEntry{step.dist,stamp++,top.inx});
+  }
 }
 
-vector<complex<double> > agmExpand(vector<complex<double>> loop,double center)
+void agmExpand(Span<const complex<double> > loop,double center,Span<complex<double> > out)
 /* Starting angles and where they end up:
  * 0°		(1,0)
  * 15°		(0,1/12)
@@ -250,28 +308,27 @@ vector<complex<double> > agmExpand(vector<complex<double>> loop,double center)
  * Swapping should start at 0°/180° and 90°/270° and proceed in both directions,
  * ending at 45°/225° and 135°/315°, where the numbers being swapped
  * end up equal.
+ *
+ * The expanded loop, twice as long as loop, is written to out.
  */
 {
-  vector<complex<double> > ret;
   vector<int> fractInx;
-  int i,j,sz=loop.size(),innings=0;
-  array<complex<double>,2> agpair;
-  vector<KheSwapStep *> swapStep;
-  assert(sz%2==0);
-  ret.resize(sz*2);
+  int i,j,sz=loop.size(),innings=0,half=sz/2,nChunks,nGroups,nPairs;
+  vector<KheSwapStep> swapStep;
+  assert(sz%2==0 && out.size()==sz*2);
   for (i=0;i<sz;i++)
-  {
-    if (abs(loop[i])<center && abs(loop[i-1])>=center)
+    if (abs(loop[i])<center && abs(loop[(i+sz-1)%sz])>=center)
       innings++;
-    agpair=invAgm1(loop[i],loop[(i+sz/2)%sz]);
-    ret[i]=agpair[0];
-    ret[i+sz]=agpair[1];
-  }
-  if (innings>mostInnings)
-  {
-    //cout<<innings<<" innings, "<<sz<<" loop size\n";
-    mostInnings=innings;
-  }
+  nChunks=(half+kheExpandChunk-1)/kheExpandChunk;
+  taskPool().forEach(nChunks,[&](unsigned k)
+    {
+      int start=k*kheExpandChunk,n=min(half-start,kheExpandChunk);
+      invAgm1Batch(&loop[start],&loop[half+start],&out[start],&out[sz+start],n);
+      invAgm1Batch(&loop[half+start],&loop[start],&out[half+start],&out[sz+half+start],n);
+    });
+  i=mostInnings;
+  while (innings>i && !mostInnings.compare_exchange_weak(i,innings));
+  //cout<<innings<<" innings, "<<sz<<" loop size\n";
   /* The number of innings is 1, 3, 7, 13, 19, 29, ... (A099957).
    * The real arcs appear in the order 1/1, -1/3, 1/5, ..., each traced
    * as many times as the totient of the denominator. For each real arc,
@@ -287,40 +344,32 @@ vector<complex<double> > agmExpand(vector<complex<double>> loop,double center)
     if (swapStep.size()/2+fractInx.size()<=innings)
       for (j=0;j<fractInx.size();j++)
       {
-	swapStep.push_back(new KheSwapStep(fractInx[j],1,ret));
-	swapStep.push_back(new KheSwapStep(fractInx[j],-1,ret));
+	swapStep.push_back(KheSwapStep(fractInx[j],1,out));
+	swapStep.push_back(KheSwapStep(fractInx[j],-1,out));
       }
     else
       break;
   }
   findMeeters(swapStep);
-  sortSteppers(swapStep);
-  while (swapStep.size())
+  nPairs=swapStep.size()/2;
+  nGroups=min(nPairs,(int)(sz/kheExpandChunk));
+  if (nGroups<2)
+    runSteppers(swapStep.data(),swapStep.size(),out);
+  else
   {
-    swapStep.back()->step(ret);
-    swapStep.back()->swap(ret);
-    sz=swapStep.size();
-    if (meet(*swapStep[sz-1],*swapStep[sz-1]->partner))
-    {
-      for (i=0;i<sz-2;i++)
-	if (swapStep[i]==swapStep[sz-1]->partner)
-	  swap(swapStep[i],swapStep[i+1]);
-      delete swapStep[sz-1];
-      delete swapStep[sz-2];
-      swapStep.resize(sz-2);
-    }
-    sz=swapStep.size();
-    i=sz-1;
-    while (i>0 && *swapStep[i]<*swapStep[i-1])
-    {
-      swap(swapStep[i],swapStep[i-1]);
-      i--;
-    }
+    /* Groups of consecutive pairs, each run by itself. The arcs differ
+     * a lot in length, so there are more groups than threads.
+     */
+    nGroups=min(nGroups,4*(int)taskPool().size()+1);
+    taskPool().forEach(nGroups,[&](unsigned k)
+      {
+	int first=(int64_t)k*nPairs/nGroups,last=(int64_t)(k+1)*nPairs/nGroups;
+	runSteppers(&swapStep[2*first],2*(last-first),out);
+      });
   }
-  return ret;
 }
 
-double avgRadius(vector<complex<double> > loop)
+double avgRadius(Span<const complex<double> > loop)
 {
   int i,sz=loop.size();
   vector<double> diams;
@@ -330,7 +379,7 @@ double avgRadius(vector<complex<double> > loop)
   return pairwisesum(diams)/sz;
 }
 
-vector<double> vecLog(vector<complex<double> > loop)
+vector<double> vecLog(Span<const complex<double> > loop)
 {
   vector<double> ret;
   int i;
@@ -339,7 +388,7 @@ vector<double> vecLog(vector<complex<double> > loop)
   return ret;
 }
 
-vector<double> vecArg(vector<complex<double> > loop)
+vector<double> vecArg(Span<const complex<double> > loop)
 /* last2a is an attempt to follow the loop near -1/128, in which some steps
  * are bigger than 180°. It didn't work.
  */
@@ -358,10 +407,43 @@ vector<double> vecArg(vector<complex<double> > loop)
   return ret;
 }
 
+void KheLoopArena::reserve(size_t n)
+{
+  if (room<n)
+  {
+    blocks.emplace_back(new complex<double>[n]);
+    block=blocks.back().get();
+    room=n;
+    total+=n;
+  }
+}
+
+complex<double> *KheLoopArena::allocate(size_t n)
+{
+  complex<double> *ret;
+  reserve(n);
+  ret=block;
+  block+=n;
+  room-=n;
+  return ret;
+}
+
+unsigned memoSlot(double x)
+{
+  uint64_t bits;
+  memcpy(&bits,&x,sizeof(bits));
+  return (bits*0x9e3779b97f4a7c15)>>(64-kheMemoBits);
+}
+
 void Khe::init(int circleSize)
 {
   int64_t i=abs(circleSize),j=0,n=0,sq=i*i;
   radius=i;
+  id=++lastKheId;
+  logLimit=log((2-radius*DBL_EPSILON)*4/(radius*DBL_EPSILON));
+  useClock=0;
+  totalBytes=0;
+  budget=0;
   while (i>j)
     if (i*i+j*j==sq)
     {
@@ -384,6 +466,50 @@ void Khe::init(int circleSize)
    * of radius circleSize. Such numbers are 65, 85, 145, 185, 205, 221, etc.
    * See http://oeis.org/A131574 .
    */
+  initUnmix();
+}
+
+void Khe::initUnmix()
+/* A loop of 9m points is nine subloops of m evenly spaced points, the rth
+ * being shifted by arcTan[r]*4/m. In the transform of subloop r, the
+ * coefficients of frequencies k+qm, q=-4...4, add up, each turned by
+ * exp(iqm*arcTan[r]*4/m)=w[r]**q. unmix is the inverse of the matrix
+ * w[r]**q, found by Gauss-Jordan elimination; the w[r] are spread around
+ * the circle, so it is well conditioned.
+ */
+{
+  complex<double> a[9][18],w,t;
+  int r,q,i,piv;
+  for (r=0;r<9;r++)
+  {
+    w=polar(1.,4*arcTan[r]);
+    for (q=0;q<9;q++)
+    {
+      a[r][q]=pow(w,q-4);
+      a[r][q+9]=(double)(q==r);
+    }
+  }
+  for (i=0;i<9;i++)
+  {
+    for (piv=r=i;r<9;r++)
+      if (abs(a[r][i])>abs(a[piv][i]))
+	piv=r;
+    for (q=0;q<18;q++)
+      swap(a[i][q],a[piv][q]);
+    t=a[i][i];
+    for (q=0;q<18;q++)
+      a[i][q]/=t;
+    for (r=0;r<9;r++)
+      if (r!=i)
+      {
+	t=a[r][i];
+	for (q=0;q<18;q++)
+	  a[r][q]-=t*a[i][q];
+      }
+  }
+  for (r=0;r<9;r++)
+    for (q=0;q<9;q++)
+      unmix[r][q]=a[r][q+9];
 }
 
 Khe::Khe()
@@ -417,30 +543,205 @@ double Khe::circleCenter(double x)
   return exp(-x)*radius/4*DBL_EPSILON;
 }
 
-KheCachedLoop Khe::_getLoop(double x)
+shared_ptr<KheLoopSet> Khe::loopSet(double center)
+/* Returns the set of loops for center, making an empty one if there is none.
+ */
 {
-  double center=0,tryCenter=0;
-  KheCachedLoop ret;
-  ret.center=0;
-  ret.loop=nullptr;
-  int nExpand=-1,i;
-  for (i=0;x<0 && tryCenter<2-radius*DBL_EPSILON;i++)
   {
-    tryCenter=circleCenter(ldexp(x,i));
-    if (tryCenter<2-radius*DBL_EPSILON)
+    shared_lock<shared_mutex> lock(cacheMutex);
+    auto found=loopCache.find(center);
+    if (found!=loopCache.end())
+      return found->second;
+  }
+  unique_lock<shared_mutex> lock(cacheMutex);
+  shared_ptr<KheLoopSet> &set=loopCache[center];
+  if (!set)
+    set=make_shared<KheLoopSet>();
+  return set;
+}
+
+void Khe::expandLoops(KheLoopSet &set,double center,int nExpand)
+/* Makes the loops of set up to level nExpand. If another thread is making
+ * them, waits for it, then makes whatever it didn't.
+ */
+{
+  lock_guard<mutex> lock(set.expandMutex);
+  int n=set.nLevels.load(memory_order_relaxed),i;
+  size_t oldBytes=set.bytes,need=0;
+  for (i=n;i<=nExpand;i++)
+    if (!store || store->find(radius,center,i).size()!=(36<<i))
+      need+=36<<i;
+  set.arena->reserve(need);
+  while (n<=nExpand)
+  {
+    makeLevel(set,center,n);
+    set.nLevels.store(++n,memory_order_release);
+  }
+  if (!set.evicted)
+    totalBytes+=set.bytes-oldBytes;
+}
+
+void Khe::makeLevel(KheLoopSet &set,double center,int n)
+/* Makes level n of set, from the store if it has it, else by expanding
+ * level n-1, then adds it to the store if the store is writable.
+ */
+{
+  Span<const complex<double> > stored;
+  Span<complex<double> > loop;
+  vector<complex<double> > circle;
+  if (store)
+    stored=store->find(radius,center,n);
+  if (stored.size()==(36<<n))
+  {
+    set.level[n]=stored;
+    set.owner[n]=store;
+  }
+  else
+  {
+    loop=Span<complex<double> >(set.arena->allocate(36<<n),36<<n);
+    if (n)
+      agmExpand(set.level[n-1],center,loop);
+    else
     {
-      nExpand=i;
-      center=tryCenter;
+      circle=tinyCircle(center);
+      copy(circle.begin(),circle.end(),loop.begin());
     }
+    set.level[n]=loop;
+    set.owner[n]=set.arena;
+    set.bytes=set.arena->bytes()+set.spectrumBytes;
+    if (store && store->isWritable())
+      store->append(radius,center,n,set.level[n]);
   }
+}
+
+void Khe::setLoopStore(shared_ptr<KheLoopStore> loopStore)
+/* Loops are looked for in loopStore before being computed. Set it before
+ * the Khe is shared between threads.
+ */
+{
+  store=loopStore;
+}
+
+void Khe::trimCache(double keep)
+/* Drops the least recently used sets of loops, other than keep's, until
+ * the cache is within budget. A set being expanded is skipped. Loops that
+ * have been handed out stay valid until their holders let go of them.
+ */
+{
+  unique_lock<shared_mutex> lock(cacheMutex);
+  vector<pair<uint64_t,double> > byUse;
+  map<double,shared_ptr<KheLoopSet> >::iterator j;
+  int i;
+  for (j=loopCache.begin();j!=loopCache.end();++j)
+    if (j->first!=keep)
+      byUse.push_back(make_pair(j->second->lastUse.load(),j->first));
+  sort(byUse.begin(),byUse.end());
+  for (i=0;i<byUse.size() && totalBytes>budget;i++)
+  {
+    j=loopCache.find(byUse[i].second);
+    unique_lock<mutex> setLock(j->second->expandMutex,try_to_lock);
+    if (setLock.owns_lock())
+    {
+      j->second->evicted=true;
+      totalBytes-=j->second->bytes;
+      setLock.unlock();
+      loopCache.erase(j);
+    }
+  }
+}
+
+void Khe::setCacheBudget(size_t bytes)
+/* Sets the most bytes the cached loops may take; 0 means no limit.
+ * The set of loops in use is kept even if it alone is over budget.
+ */
+{
+  budget=bytes;
+  if (budget && totalBytes>budget)
+    trimCache(NAN);
+}
+
+size_t Khe::cacheBytes()
+{
+  return totalBytes;
+}
+
+int Khe::expansions(double x,double &center)
+/* Returns the number of times the tiny circle is expanded to make the loop
+ * at x, and sets center to its center. This is the greatest i for which
+ * circleCenter(ldexp(x,i)) is less than 2-radius*DBL_EPSILON, which is
+ * close to the difference of the binary exponents of logLimit and x; the
+ * estimate is checked with circleCenter, which increases with i. If even
+ * i=0 is too big, or x is not negative, returns -1 and sets center to 0.
+ */
+{
+  double limit=2-radius*DBL_EPSILON;
+  int i=-1;
+  center=0;
+  if (x<0 && circleCenter(x)<limit)
+  {
+    i=max(ilogb(logLimit)-ilogb(x)-1,0);
+    while (i>0 && !(circleCenter(ldexp(x,i))<limit))
+      i--;
+    while (circleCenter(ldexp(x,i+1))<limit)
+      i++;
+    center=circleCenter(ldexp(x,i));
+  }
+  return i;
+}
+
+shared_ptr<KheLoopSet> Khe::_getSet(double x,int &nExpand,double &center)
+/* Returns the set of loops for x, expanded through level nExpand, or null
+ * if center is 0. Looks in this thread's memo first. A memo entry holds
+ * the set weakly, so it doesn't keep a dropped set alive, and is keyed by
+ * the Khe's id, which is never reused, as well as x. A dropped set can
+ * still be alive because a view or spectrum holds it; it is not used, as
+ * its bytes are no longer counted and another set may replace it.
+ */
+{
+  shared_ptr<KheLoopSet> set;
+  KheMemo &memo=kheMemo[memoSlot(x)];
+  if (memo.kheId==id && memo.x==x)
+  {
+    nExpand=memo.nExpand;
+    center=memo.center;
+    set=memo.set.lock();
+    if (set && set->evicted)
+      set.reset();
+  }
+  else
+    nExpand=expansions(x,center);
   if (center)
   {
-    if (!loopCache.count(center))
-      loopCache[center].push_back(tinyCircle(center));
-    while (loopCache[center].size()-1<nExpand)
-      loopCache[center].push_back(agmExpand(loopCache[center].back(),center));
-    ret.loop=&loopCache[center][nExpand];
-    ret.center=center;
+    assert(nExpand<kheMaxLevels);
+    if (!set)
+      set=loopSet(center);
+    set->lastUse.store(++useClock,memory_order_relaxed);
+    if (set->nLevels.load(memory_order_acquire)<=nExpand)
+    {
+      expandLoops(*set,center,nExpand);
+      if (budget && totalBytes>budget)
+	trimCache(center);
+    }
+  }
+  memo.kheId=id;
+  memo.x=x;
+  memo.nExpand=nExpand;
+  memo.center=center;
+  memo.set=set;
+  return set;
+}
+
+KheCachedLoop Khe::_getLoop(double x)
+{
+  double center;
+  KheCachedLoop ret;
+  int nExpand;
+  shared_ptr<KheLoopSet> set=_getSet(x,nExpand,center);
+  ret.center=center;
+  if (set)
+  {
+    ret.loop=set->level[nExpand];
+    ret.owner=set->owner[nExpand];
   }
   return ret;
 }
@@ -452,15 +753,138 @@ vector<complex<double> > Khe::getLoop(double x)
  * the numbers in the loop in the wrong order. If x>=0, returns empty.
  */
 {
-  KheCachedLoop cloop;
+  KheLoopView view=loopView(x);
   vector<complex<double> > ret;
   int i;
-  cloop=_getLoop(x);
-  if (cloop.center)
+  ret.reserve(view.size());
+  for (i=0;i<view.size();i++)
+    ret.push_back(view[i]);
+  return ret;
+}
+
+KheLoopView Khe::loopView(double x)
+/* Returns the same loop as getLoop, as a view into the cache.
+ */
+{
+  return KheLoopView(_getLoop(x));
+}
+
+vector<complex<double> > KheSpectrum::resample(int n) const
+/* Returns the loop at n evenly spaced points, starting at y=0. At those
+ * points exp(kiy) is the same for k and k+n, so the coefficients are
+ * folded mod n, which loses nothing for any n, and transformed back in
+ * one go.
+ */
+{
+  vector<complex<double> > folded(n,0.),ret;
+  int i;
+  for (i=0;i<coeff.size();i++)
+    folded[i%n]+=coeff[i];
+  ret=dft(folded,1);
+  for (i=0;i<n;i++)
+    ret[i]/=center;
+  return ret;
+}
+
+shared_ptr<const KheSpectrum> Khe::makeSpectrum(Span<const complex<double> > loop,double center)
+/* Transforms the nine subloops, then for each frequency k0 mod m, undoes
+ * each subloop's shift and separates the nine frequencies that alias to
+ * k0 with unmix. The frequencies found are -9m/2 through 9m/2-1; for k0 at
+ * least m/2, they are one m lower than unmix's, which multiplies each
+ * subloop's sum by w[r].
+ *
+ * The loops' errors, which are small but well above an ulp, are spread
+ * over all frequencies. The negative ones are nothing but error and are
+ * dropped; the positive ones are cut off where the sum of the magnitudes
+ * of the rest is kheSpectrumTol times the greatest, which is well within
+ * the loops' accuracy. Near -1/60, where the loops go out of order, the
+ * error is large and little is cut off.
+ */
+{
+  int sz=loop.size(),m=sz/9,r,q,k0,shift,hi;
+  vector<complex<double> > sub[9],all(sz);
+  complex<double> g[9],sum;
+  shared_ptr<KheSpectrum> ret=make_shared<KheSpectrum>();
+  double big=0,tail=0;
+  assert(sz==9*m && isPow2(m));
+  for (r=0;r<9;r++)
+  {
+    sub[r].resize(m);
+    for (k0=0;k0<m;k0++)
+      sub[r][k0]=loop[9*k0+r];
+    fft(sub[r],-1);
+  }
+  for (k0=0;k0<m;k0++)
+  {
+    shift=(k0>=m/2);
+    for (r=0;r<9;r++)
+      g[r]=sub[r][k0]/(double)m*polar(1.,-4*arcTan[r]*(k0-shift*m)/m);
+    for (q=0;q<9;q++)
+    {
+      sum=0;
+      for (r=0;r<9;r++)
+	sum+=unmix[q][r]*g[r];
+      all[k0+(q-4-shift)*m+sz/2]=sum;
+      big=max(big,abs(sum));
+    }
+  }
+  for (hi=sz;hi>sz/2+1 && (tail+=abs(all[hi-1]))<=big*kheSpectrumTol;hi--);
+  ret->center=center;
+  ret->coeff.assign(all.begin()+sz/2,all.begin()+hi);
+  return ret;
+}
+
+shared_ptr<const KheSpectrum> Khe::spectrum(double x)
+/* Returns the Fourier coefficients of the loop at x, computing them the
+ * first time. They are kept along with the loop, not in place of it, and
+ * their bytes count against the budget too. Returns null where getLoop
+ * would return an empty vector.
+ */
+{
+  double center;
+  int nExpand;
+  shared_ptr<KheLoopSet> set=_getSet(x,nExpand,center);
+  shared_ptr<const KheSpectrum> ret;
+  if (set)
   {
-    ret=*cloop.loop;
-    for (i=0;i<ret.size();i++)
-      ret[i]/=cloop.center;
+    ret=atomic_load(&set->spectrum[nExpand]);
+    if (!ret)
+    {
+      {
+	lock_guard<mutex> lock(set->expandMutex);
+	ret=set->spectrum[nExpand];
+	if (!ret)
+	{
+	  ret=makeSpectrum(set->level[nExpand],center);
+	  atomic_store(&set->spectrum[nExpand],ret);
+	  set->spectrumBytes+=ret->bytes();
+	  set->bytes+=ret->bytes();
+	  if (!set->evicted)
+	    totalBytes+=ret->bytes();
+	}
+      }
+      if (budget && totalBytes>budget)
+	trimCache(center);
+    }
+  }
+  return ret;
+}
+
+vector<complex<double> > Khe::resample(double x,int n)
+/* Returns խ(x+iy) at n evenly spaced y from 0 to 2π, by one transform of
+ * the loop's spectrum.
+ */
+{
+  shared_ptr<const KheSpectrum> sp=spectrum(x);
+  vector<complex<double> > ret;
+  int i;
+  if (sp)
+    ret=sp->resample(n);
+  else
+  {
+    for (i=0;i<n;i++)
+      ret.push_back(complex<double>(x,i*2*M_PI/n));
+    evaluate(ret,ret);
   }
   return ret;
 }
@@ -471,15 +895,19 @@ KheInterp Khe::getInterp(complex<double> z)
  * amount by which z.imag() is along the interval from points[1] to points[10].
  */
 {
-  KheCachedLoop cloop;
+  return getInterp(_getLoop(z.real()),z);
+}
+
+KheInterp Khe::getInterp(const KheCachedLoop &cloop,complex<double> z)
+// Same, given the loop for z.real().
+{
   KheInterp ret;
   double y;
   int pointStart,i,sz;
-  cloop=_getLoop(z.real());
   if (cloop.center)
   {
     y=z.imag()-(2*M_PI)*rint(z.imag()/(2*M_PI));
-    sz=cloop.loop->size();
+    sz=cloop.loop.size();
     pointStart=lrint(y*(sz/18)/M_PI)*9;
     ret.along=y*(sz/36)-(pointStart/9)*(M_PI/2);
     if (ret.along<0)
@@ -490,7 +918,7 @@ KheInterp Khe::getInterp(complex<double> z)
     if (pointStart<2)
       pointStart+=sz;
     for (i=0;i<12;i++)
-      ret.points[i]=(*cloop.loop)[(pointStart+i-1)%sz]/cloop.center;
+      ret.points[i]=cloop.loop[(pointStart+i-1)%sz]/cloop.center;
   }
   else
     ret.along=NAN;
@@ -502,6 +930,84 @@ double Khe::xt(int n)
   return arcTan[9]*(n/9)+arcTan[n%9];
 }
 
+template<int B> struct KheLanes
+/* Cubic interpolations of B points, one in each lane. The four points are
+ * relative to off, and interval and subalong are as in operator().
+ */
+{
+  double pr[4][B],pi[4][B],offr[B],offi[B];
+  double interval[3][B],subalong[B];
+  double outr[B],outi[B];
+  size_t inx[B];
+};
+
+template<int B> void kheLaneSetup(KheLanes<B> &l,int k,const KheInterp &interp,const double *arcTan)
+/* Finds which of the nine intervals of the circle interp.along is in, and
+ * puts the four points around it in lane k.
+ */
+{
+  int i,n;
+  double subalong,interval[3];
+  complex<double> off,pnt;
+  assert(interp.along>=arcTan[0]);
+  for (n=0;n<8 && arcTan[n+1]<=interp.along;n++);
+  subalong=interp.along-arcTan[n];
+  interval[1]=arcTan[n+1]-arcTan[n];
+  if (abs(interp.points[n+1])<abs(interp.points[n+2]))
+    off=interp.points[n+1];
+  else
+    off=interp.points[n+2];
+  for (i=0;i<4;i++)
+  {
+    pnt=interp.points[n+i]-off;
+    l.pr[i][k]=pnt.real();
+    l.pi[i][k]=pnt.imag();
+  }
+  assert(subalong<interval[1]);
+  if (n==0)
+    interval[0]=arcTan[1];
+  else
+    interval[0]=arcTan[n]-arcTan[n-1];
+  if (n==8)
+    interval[2]=arcTan[1];
+  else
+    interval[2]=arcTan[n+2]-arcTan[n+1];
+  for (i=0;i<3;i++)
+    l.interval[i][k]=interval[i];
+  l.subalong[k]=subalong;
+  l.offr[k]=off.real();
+  l.offi[k]=off.imag();
+}
+
+template<int B> void kheCubicLanes(KheLanes<B> &l,int live)
+/* Interpolates lanes 0 through live-1. This is operator()'s complex
+ * arithmetic written out on the real and imaginary parts, in the same
+ * order, so the results are the same bits, and the loop can be vectorized.
+ */
+{
+  int k;
+  double i0,i1,i2,slp0r,slp0i,slp1r,slp1i,c0r,c0i,c1r,c1i,p,q;
+  for (k=0;k<live;k++)
+  {
+    i0=l.interval[0][k];
+    i1=l.interval[1][k];
+    i2=l.interval[2][k];
+    slp0r=((l.pr[2][k]-l.pr[1][k])*i0+(l.pr[1][k]-l.pr[0][k])/i0*i1*i1)/(i0+i1);
+    slp0i=((l.pi[2][k]-l.pi[1][k])*i0+(l.pi[1][k]-l.pi[0][k])/i0*i1*i1)/(i0+i1);
+    slp1r=((l.pr[2][k]-l.pr[1][k])*i2+(l.pr[3][k]-l.pr[2][k])/i2*i1*i1)/(i1+i2);
+    slp1i=((l.pi[2][k]-l.pi[1][k])*i2+(l.pi[3][k]-l.pi[2][k])/i2*i1*i1)/(i1+i2);
+    c0r=l.pr[1][k]+slp0r/3.;
+    c0i=l.pi[1][k]+slp0i/3.;
+    c1r=l.pr[2][k]-slp1r/3.;
+    c1i=l.pi[2][k]-slp1i/3.;
+    p=l.subalong[k]/i1;
+    q=1-p;
+    p=1-q;
+    l.outr[k]=(l.pr[1][k]*q*q*q+3.*c0r*p*q*q+3.*c1r*p*p*q+l.pr[2][k]*p*p*p)+l.offr[k];
+    l.outi[k]=(l.pi[1][k]*q*q*q+3.*c0i*p*q*q+3.*c1i*p*p*q+l.pi[2][k]*p*p*p)+l.offi[k];
+  }
+}
+
 complex<double> Khe::operator()(complex<double> z)
 /* uses cubic interpolation.
  * Computes the khe function of z. If z is too close to the imaginary axis,
@@ -509,55 +1015,79 @@ complex<double> Khe::operator()(complex<double> z)
  */
 {
   KheInterp interp=getInterp(z);
+  KheLanes<1> l;
   complex<double> ret;
-  int i,n;
-  double subalong,interval[3],p,q;
-  complex<double> off,pnt[4],ctrl[2],slp[2];
   if (z.real()>=0)
     ret=complex<double>(NAN,NAN);
   else if (isnan(interp.along))
     ret=4.*exp(z)+1.;
   else
   {
-    for (i=0;i<9;i++)
-      if (arcTan[i]<=interp.along)
+    kheLaneSetup(l,0,interp,arcTan);
+    kheCubicLanes(l,1);
+    ret=complex<double>(l.outr[0],l.outi[0]);
+  }
+  return ret;
+}
+
+void Khe::evaluate(Span<const complex<double> > in,Span<complex<double> > out)
+/* Computes the khe function of each number in in and puts it in the same
+ * place in out, giving the same results as operator(). The numbers are
+ * sorted by real part, each real part's loop is looked up once, and the
+ * interpolations are done in blocks of lanes. in and out may be the same
+ * array; each number is read before its own result is written.
+ */
+{
+  vector<size_t> order;
+  unique_ptr<KheLanes<kheLaneBlock> > l(new KheLanes<kheLaneBlock>);
+  KheCachedLoop cloop;
+  KheInterp interp;
+  size_t i,start,end,base,k;
+  int live;
+  double x;
+  assert(in.size()==out.size());
+  for (i=0;i<in.size();i++)
+    if (isnan(in[i].real()))
+      out[i]=(*this)(in[i]);
+    else
+      order.push_back(i);
+  sort(order.begin(),order.end(),[&in](size_t a,size_t b)
+    {
+      return in[a].real()<in[b].real();
+    });
+  for (start=0;start<order.size();start=end)
+  {
+    x=in[order[start]].real();
+    for (end=start+1;end<order.size() && in[order[end]].real()==x;end++);
+    if (x>=0)
+    {
+      for (i=start;i<end;i++)
+	out[order[i]]=complex<double>(NAN,NAN);
+      continue;
+    }
+    cloop=_getLoop(x);
+    for (base=start;base<end;base+=kheLaneBlock)
+    {
+      live=0;
+      for (k=base;k<end && k<base+kheLaneBlock;k++)
       {
-	n=i;
-	subalong=interp.along-arcTan[i];
-	interval[1]=arcTan[i+1]-arcTan[i];
+	interp=getInterp(cloop,in[order[k]]);
+	if (isnan(interp.along))
+	  out[order[k]]=4.*exp(in[order[k]])+1.;
+	else
+	{
+	  kheLaneSetup(*l,live,interp,arcTan);
+	  l->inx[live++]=order[k];
+	}
       }
-    if (abs(interp.points[n+1])<abs(interp.points[n+2]))
-      off=interp.points[n+1];
-    else
-      off=interp.points[n+2];
-    for (i=0;i<4;i++)
-      pnt[i]=interp.points[n+i]-off;
-    assert(subalong<interval[1]);
-    if (n==0)
-      interval[0]=arcTan[1];
-    else
-      interval[0]=arcTan[n]-arcTan[n-1];
-    if (n==8)
-      interval[2]=arcTan[1];
-    else
-      interval[2]=arcTan[n+2]-arcTan[n+1];
-    slp[0]=((pnt[2]-pnt[1])*interval[0]+
-	    (pnt[1]-pnt[0])/interval[0]*interval[1]*interval[1])/
-	    (interval[0]+interval[1]);
-    slp[1]=((pnt[2]-pnt[1])*interval[2]+
-	    (pnt[3]-pnt[2])/interval[2]*interval[1]*interval[1])/
-	    (interval[1]+interval[2]);
-    ctrl[0]=pnt[1]+slp[0]/3.;
-    ctrl[1]=pnt[2]-slp[1]/3.;
-    p=subalong/interval[1];
-    q=1-p;
-    p=1-q;
-    ret=(pnt[1]*q*q*q+3.*ctrl[0]*p*q*q+3.*ctrl[1]*p*p*q+pnt[2]*p*p*p)+off;
+      kheCubicLanes(*l,live);
+      for (k=0;k<live;k++)
+	out[l->inx[k]]=complex<double>(l->outr[k],l->outi[k]);
+    }
   }
-  return ret;
 }
 
-void Khe::outMaxMag(vector<complex<double> > &loop)
+void Khe::outMaxMag(Span<const complex<double> > loop)
 /* Outputs all local maxima of the absolute value of the loop.
  * loop[0] is the global maximum.
  */
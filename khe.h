@@ -16,13 +16,124 @@
 #include <vector>
 #include <array>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include "span.h"
+#include "loopstore.h"
 
 unsigned gcd(unsigned a,unsigned b);
 
+const int kheMaxLevels=40;
+
 struct KheCachedLoop
 {
   double center;
-  std::vector<std::complex<double> > *loop;
+  Span<const std::complex<double> > loop;
+  std::shared_ptr<const void> owner; // keeps loop valid
+};
+
+class KheLoopArena
+/* Storage for the loops of one center. Blocks are not moved or freed until
+ * the arena is, so a loop stays where it was put. Before making levels,
+ * reserve room for all of them, so that they go in one block. Not
+ * thread-safe; the set's expandMutex guards it.
+ */
+{
+public:
+  KheLoopArena():block(nullptr),room(0),total(0)
+  {
+  }
+  void reserve(size_t n);
+  std::complex<double> *allocate(size_t n);
+  size_t bytes() const
+  {
+    return total*sizeof(std::complex<double>);
+  }
+private:
+  std::vector<std::unique_ptr<std::complex<double>[]> > blocks;
+  std::complex<double> *block;
+  size_t room,total;
+};
+
+struct KheSpectrum
+/* The Fourier coefficients of a loop: the loop at y is the sum of
+ * coeff[k]*exp(kiy), divided by center. There are no negative frequencies,
+ * as խ(z) is a power series in exp(z), and the series is cut off where
+ * the rest of it is too small to matter.
+ */
+{
+  double center;
+  std::vector<std::complex<double> > coeff;
+  std::vector<std::complex<double> > resample(int n) const;
+  size_t bytes() const
+  {
+    return coeff.size()*sizeof(std::complex<double>);
+  }
+};
+
+struct KheLoopSet
+/* The loops made from one circle center. level[i] has 36<<i points.
+ * Levels below nLevels are finished and never change, so they are read
+ * without locking; a thread that needs more levels holds expandMutex while
+ * it makes them, so no two threads expand the same center. A level's
+ * spectrum is made on first use, also under expandMutex, and read with
+ * atomic_load.
+ */
+{
+  Span<const std::complex<double> > level[kheMaxLevels];
+  std::shared_ptr<const void> owner[kheMaxLevels]; // arena or a KheLoopStore
+  std::shared_ptr<const KheSpectrum> spectrum[kheMaxLevels];
+  std::shared_ptr<KheLoopArena> arena;
+  std::atomic<int> nLevels;
+  std::mutex expandMutex;
+  std::atomic<uint64_t> lastUse;
+  size_t bytes,spectrumBytes; // guarded by expandMutex
+  std::atomic<bool> evicted; // set under expandMutex, but read by the memo without it
+  KheLoopSet():arena(std::make_shared<KheLoopArena>()),nLevels(0),lastUse(0),bytes(0),spectrumBytes(0),evicted(false)
+  {
+  }
+};
+
+class KheLoopView
+/* A cached loop, as getLoop would return it, without copying it. Points
+ * are divided by the scale as they are read; raw() is the loop as cached,
+ * for callers that would rather divide by scale() themselves. The view
+ * keeps the loop alive even if the cache drops it.
+ */
+{
+public:
+  KheLoopView():div(0)
+  {
+  }
+  KheLoopView(const KheCachedLoop &cloop):loop(cloop.loop),div(cloop.center),owner(cloop.owner)
+  {
+  }
+  size_t size() const
+  {
+    return loop.size();
+  }
+  bool empty() const
+  {
+    return loop.empty();
+  }
+  std::complex<double> operator[](size_t i) const
+  {
+    return loop[i]/div;
+  }
+  Span<const std::complex<double> > raw() const
+  {
+    return loop;
+  }
+  double scale() const
+  {
+    return div;
+  }
+private:
+  Span<const std::complex<double> > loop;
+  double div;
+  std::shared_ptr<const void> owner;
 };
 
 struct KheInterp
@@ -35,9 +146,9 @@ class KheSwapStep
 {
 public:
   KheSwapStep()=default;
-  KheSwapStep(int n,int d,std::vector<std::complex<double> > &loop);
-  void step(std::vector<std::complex<double> > &loop);
-  void swap(std::vector<std::complex<double> > &loop);
+  KheSwapStep(int n,int d,Span<std::complex<double> > loop);
+  void step(Span<std::complex<double> > loop);
+  void swap(Span<std::complex<double> > loop);
   std::complex<double> lastDiff;
   double dist;
   KheSwapStep *partner;
@@ -48,10 +159,10 @@ public:
   friend bool meet(KheSwapStep &n,KheSwapStep &s);
 };
 
-std::vector<std::complex<double> > agmExpand(std::vector<std::complex<double> > loop);
-std::vector<double> vecLog(std::vector<std::complex<double> > loop);
-std::vector<double> vecArg(std::vector<std::complex<double> > loop);
-double avgRadius(std::vector<std::complex<double> > loop);
+void agmExpand(Span<const std::complex<double> > loop,double center,Span<std::complex<double> > out);
+std::vector<double> vecLog(Span<const std::complex<double> > loop);
+std::vector<double> vecArg(Span<const std::complex<double> > loop);
+double avgRadius(Span<const std::complex<double> > loop);
 double xt(int n);
 
 class Khe
@@ -60,24 +171,50 @@ public:
   Khe();
   Khe(int circleSize); // Must be a member of http://oeis.org/A131574
   std::vector<std::complex<double> > getLoop(double x);
+  KheLoopView loopView(double x);
   double xt(int n);
   std::complex<double> operator()(std::complex<double> z);
-  void outMaxMag(std::vector<std::complex<double> > &loop);
+  void evaluate(Span<const std::complex<double> > in,Span<std::complex<double> > out);
+  std::shared_ptr<const KheSpectrum> spectrum(double x);
+  std::vector<std::complex<double> > resample(double x,int n);
+  void outMaxMag(Span<const std::complex<double> > loop);
+  void setCacheBudget(size_t bytes);
+  size_t cacheBytes();
+  void setLoopStore(std::shared_ptr<KheLoopStore> loopStore);
 private:
   int cirCoord[36];
   double arcTan[10];
   int radius; // Radius of circle returned by tinyCircle
-  std::map<double,std::vector<std::vector<std::complex<double> > > > loopCache;
+  uint64_t id; // distinguishes Khes in the memo of looked-up loops
+  std::complex<double> unmix[9][9]; // separates the aliases of the nine subloops
+  double logLimit; // log of greatest circle center over circleCenter(0)
+  std::map<double,std::shared_ptr<KheLoopSet> > loopCache;
+  std::shared_mutex cacheMutex;
+  std::atomic<uint64_t> useClock;
+  std::atomic<size_t> totalBytes,budget;
+  std::shared_ptr<KheLoopStore> store;
   /* The key is the circle center used to make the circular loop, which loops
   * must be divided by when fetching them from cache. The value is a sequence
   * of loops, the 0th being the circular loop with 36 points, and each
-  * successive loop having twice as many points.
+  * successive loop having twice as many points. cacheMutex guards the map;
+  * the sets are shared so that they outlive a lookup. If the loops take
+  * more than budget bytes, the least recently used centers are dropped.
+  * Loops found in store are used from its mapping and take no bytes.
   */
   void init(int circleSize);
+  void initUnmix();
   std::vector<std::complex<double> > tinyCircle(std::complex<double> center);
   double circleCenter(double x);
+  int expansions(double x,double &center);
+  std::shared_ptr<KheLoopSet> loopSet(double center);
+  void expandLoops(KheLoopSet &set,double center,int nExpand);
+  void makeLevel(KheLoopSet &set,double center,int n);
+  void trimCache(double keep);
+  std::shared_ptr<KheLoopSet> _getSet(double x,int &nExpand,double &center);
   KheCachedLoop _getLoop(double x);
+  std::shared_ptr<const KheSpectrum> makeSpectrum(Span<const std::complex<double> > loop,double center);
   KheInterp getInterp(std::complex<double> z);
+  KheInterp getInterp(const KheCachedLoop &cloop,std::complex<double> z);
 };
 
 #endif
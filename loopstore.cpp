@@ -0,0 +1,152 @@
+/******************************************************/
+/*                                                    */
+/* loopstore.cpp - file of khe loops                  */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "loopstore.h"
+using namespace std;
+
+const char kheStoreMagic[8]={'A','G','M','L','O','O','P','S'};
+
+bool goodHeader(const KheStoreHeader &hdr)
+{
+  return memcmp(hdr.magic,kheStoreMagic,8)==0 && hdr.version==kheStoreVersion &&
+	 hdr.byteOrder==kheStoreByteOrder;
+}
+
+KheLoopStore::KheLoopStore(const string &filename,bool wr)
+/* Opens the store. If it's writable and the file is missing or empty,
+ * makes it. If the file is not a loop store of this version and byte order,
+ * the store is closed, and find finds nothing.
+ */
+{
+  KheStoreHeader hdr;
+  struct stat st;
+  writable=wr;
+  mapAddr=nullptr;
+  mapSize=0;
+  fd=open(filename.c_str(),writable?(O_RDWR|O_CREAT):O_RDONLY,0644);
+  if (fd>=0 && writable)
+  {
+    flock(fd,LOCK_EX);
+    if (fstat(fd,&st)==0 && st.st_size==0)
+    {
+      memcpy(hdr.magic,kheStoreMagic,8);
+      hdr.version=kheStoreVersion;
+      hdr.byteOrder=kheStoreByteOrder;
+      pwrite(fd,&hdr,sizeof(hdr),0); // checked by reading it back
+    }
+    flock(fd,LOCK_UN);
+  }
+  if (fd>=0 && (pread(fd,&hdr,sizeof(hdr),0)!=sizeof(hdr) || !goodHeader(hdr)))
+  {
+    close(fd);
+    fd=-1;
+  }
+  if (fd>=0)
+  {
+    flock(fd,LOCK_SH);
+    mapSize=validEnd();
+    flock(fd,LOCK_UN);
+    mapAddr=mmap(nullptr,mapSize,PROT_READ,MAP_SHARED,fd,0);
+    if (mapAddr==MAP_FAILED)
+    {
+      close(fd);
+      fd=-1;
+      mapAddr=nullptr;
+      mapSize=0;
+    }
+  }
+  if (fd<0)
+    writable=false;
+  makeIndex();
+}
+
+KheLoopStore::~KheLoopStore()
+{
+  if (mapAddr)
+    munmap(mapAddr,mapSize);
+  if (fd>=0)
+    close(fd);
+}
+
+size_t KheLoopStore::validEnd()
+/* Returns the end of the last whole record in the file. Call it holding
+ * a lock on the file.
+ */
+{
+  struct stat st;
+  KheStoreRecord rec;
+  size_t pos=sizeof(KheStoreHeader),len,fileSize;
+  if (fstat(fd,&st))
+    return pos;
+  fileSize=st.st_size;
+  while (pos+sizeof(rec)<=fileSize && pread(fd,&rec,sizeof(rec),pos)==sizeof(rec))
+  {
+    len=sizeof(rec)+rec.count*sizeof(complex<double>);
+    if (rec.count>fileSize || pos+len>fileSize)
+      break;
+    pos+=len;
+  }
+  return pos;
+}
+
+void KheLoopStore::makeIndex()
+{
+  const char *base=(const char *)mapAddr;
+  const KheStoreRecord *rec;
+  size_t pos=sizeof(KheStoreHeader);
+  while (base && pos+sizeof(KheStoreRecord)<=mapSize)
+  {
+    rec=(const KheStoreRecord *)(base+pos);
+    pos+=sizeof(KheStoreRecord);
+    index[make_tuple(rec->radius,rec->center,rec->level)]=
+      Span<const complex<double> >((const complex<double> *)(base+pos),rec->count);
+    pos+=rec->count*sizeof(complex<double>);
+  }
+}
+
+Span<const complex<double> > KheLoopStore::find(int radius,double center,int level) const
+/* Returns the loop, which stays mapped as long as the store is open,
+ * or an empty span if the file doesn't have it.
+ */
+{
+  auto found=index.find(make_tuple(radius,center,level));
+  if (found==index.end())
+    return Span<const complex<double> >();
+  return found->second;
+}
+
+bool KheLoopStore::append(int radius,double center,int level,Span<const complex<double> > loop)
+/* Adds the loop to the end of the file. Returns false if the store
+ * isn't writable or the write failed.
+ */
+{
+  KheStoreRecord rec;
+  size_t pos,len=loop.size()*sizeof(complex<double>);
+  bool ret;
+  if (!writable)
+    return false;
+  lock_guard<mutex> lock(appendMutex);
+  rec.radius=radius;
+  rec.level=level;
+  rec.center=center;
+  rec.count=loop.size();
+  flock(fd,LOCK_EX);
+  pos=validEnd();
+  ret=ftruncate(fd,pos)==0 &&
+      pwrite(fd,&rec,sizeof(rec),pos)==sizeof(rec) &&
+      pwrite(fd,loop.data(),len,pos+sizeof(rec))==len;
+  flock(fd,LOCK_UN);
+  return ret;
+}
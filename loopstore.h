@@ -0,0 +1,82 @@
+/******************************************************/
+/*                                                    */
+/* loopstore.h - file of khe loops                    */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#ifndef LOOPSTORE_H
+#define LOOPSTORE_H
+#include <cstdint>
+#include <complex>
+#include <string>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include "span.h"
+
+/* A loop store is a file of loops computed by Khe, keyed by the radius of
+ * the tiny circle, the circle center, and the number of times the circle
+ * was expanded. The file is a header, then records, each a header followed
+ * by the points of the loop:
+ *
+ * KheStoreHeader
+ * KheStoreRecord, count complex<double>
+ * KheStoreRecord, count complex<double>
+ * ...
+ *
+ * The file is mapped read-only, so processes reading the same file share
+ * its pages. A writable store appends loops at the end, holding an exclusive
+ * flock while it does, so several processes can add to one file; a record
+ * cut short by a crash is dropped by the next append. Loops appended after
+ * the store was opened are found by stores opened later.
+ */
+
+const uint32_t kheStoreVersion=1;
+const uint32_t kheStoreByteOrder=0x01020304;
+
+struct KheStoreHeader
+{
+  char magic[8]; // "AGMLOOPS"
+  uint32_t version;
+  uint32_t byteOrder;
+};
+
+struct KheStoreRecord
+{
+  int32_t radius;
+  int32_t level;
+  double center;
+  uint64_t count;
+};
+
+class KheLoopStore
+{
+public:
+  KheLoopStore(const std::string &filename,bool writable=false);
+  ~KheLoopStore();
+  KheLoopStore(const KheLoopStore &)=delete;
+  KheLoopStore &operator=(const KheLoopStore &)=delete;
+  bool isOpen() const
+  {
+    return fd>=0;
+  }
+  bool isWritable() const
+  {
+    return writable;
+  }
+  Span<const std::complex<double> > find(int radius,double center,int level) const;
+  bool append(int radius,double center,int level,Span<const std::complex<double> > loop);
+private:
+  int fd;
+  bool writable;
+  void *mapAddr;
+  size_t mapSize;
+  std::map<std::tuple<int,double,int>,Span<const std::complex<double> > > index;
+  std::mutex appendMutex;
+  size_t validEnd();
+  void makeIndex();
+};
+#endif
@@ -13,6 +13,7 @@
 #include <cassert>
 #include <cfloat>
 #include "agm.h"
+#include "agmpath.h"
 #include "angle.h"
 #include "deriv4.h"
 #include "pairwisesum.h"
@@ -197,7 +198,7 @@ void series(double x)
  * from the loop at x. This is a slow Fourier transform for licensing reasons.
  */
 {
-  vector<complex<double>> loop=khe.getLoop(x);
+  KheLoopView loop=khe.loopView(x);
   int i,j;
   double coeff;
   vector<double> unrotated;
@@ -283,6 +284,49 @@ void checkSeriesProduct()
   }
 }
 
+void compareAgm1()
+/* Check that agm1Byte chooses the same square root and returns the same
+ * branch byte as agm1, for a and g on a polar grid and all 256 bytes of d,
+ * and for g/a just to each side of each of the 256 edges between bytes.
+ * For the latter, a and g are the roots of t²-2At+G², so that their AM is A
+ * and their GM is ±G.
+ */
+{
+  int i,j,k,n=0,bad=0;
+  AgmRec in,out0,out1;
+  complex<double> am,gm,disc;
+  for (i=0;i<97;i++)
+    for (j=-8;j<=8;j++)
+      for (k=-128;k<128;k++)
+      {
+	in.a=polar(exp(j/4.),i*2*M_PI/97);
+	in.g=polar(1.,i*6*M_PI/97+j);
+	in.d=k*0x800000;
+	out0=agm1(in);
+	out1=agm1Byte(in);
+	n++;
+	if (out0.g!=out1.g || (char)((out0.d+0x400000)>>23)!=(char)(out1.d>>23))
+	  bad++;
+      }
+  for (i=0;i<256;i++)
+    for (j=-20;j<=20;j++)
+      for (k=0;k<3;k++)
+      {
+	am=polar(1.,k*2.);
+	gm=am*polar(exp(k-1.),(i+0.5)*2*M_PI/256+j*1e-10);
+	disc=sqrt(am*am-gm*gm);
+	in.a=am+disc;
+	in.g=am-disc;
+	in.d=i*0x800000;
+	out0=agm1(in);
+	out1=agm1Byte(in);
+	n++;
+	if (out0.g!=out1.g || (char)((out0.d+0x400000)>>23)!=(char)(out1.d>>23))
+	  bad++;
+      }
+  cout<<"agm1Byte differs from agm1 in "<<bad<<" of "<<n<<" cases\n";
+}
+
 void plotSquare(PostScript &ps,Khe &f,complex<double> cen,complex<double> h)
 /* Plot the values of խ(z) for z being lattice points of a small square.
  * Since խ(z) is analytic, the plot should look like a square, unless the
@@ -414,7 +458,7 @@ void zoomOut()
   vector<complex<double>> curve;
   double x;
   double radius;
-  int i,j,n;
+  int i,n;
   for (i=0;i<framesPerOctave;i++)
     xcoord.push_back(-32*pow(0.5,(double)i/framesPerOctave));
   ps.open("zoom.ps");
@@ -433,8 +477,7 @@ void zoomOut()
     drawGrid(ps,bounds);
     ps.setcolor(0,0,0);
     n=lrint(-1024/x);
-    for (j=0;j<n;j++)
-      curve.push_back(khe(complex<double>(x,j*2*M_PI/n)));
+    curve=khe.resample(x,n);
     radius=hypot(bounds[1],(bounds[2]-bounds[0])/2);
     prune(curve,true,(bounds[0]+bounds[2])/2,radius,radius/1e4);
     plotCurve(ps,curve,true);
@@ -455,9 +498,8 @@ void zoomIn()
   vector<complex<double>> curve,prunedCurve;
   double x=-1./16;
   double radius,max,min,startWidth,width;
-  int i,j,n=16384; //49152
-  for (j=0;j<n;j++)
-    curve.push_back(khe(complex<double>(x,j*2*M_PI/n)));
+  int i,n=16384; //49152
+  curve=khe.resample(x,n);
   max=abs(curve[0]);
   min=abs(curve[curve.size()/2]);
   for (startWidth=1;startWidth<max/2;startWidth*=2);
@@ -562,10 +604,9 @@ void modform()
 
 int main(int argc,char **argv)
 {
-  AgmResult ag;
   PostScript ps;
-  vector<complex<double> > lattice;
   vector<vector<complex<double> > > loops;
+  vector<complex<double> > curve;
   vector<double> logloop,argloop;
   int i,j;
   double minreal=1,maxreal=1,maximag=0,diam[3];
@@ -579,51 +620,35 @@ int main(int argc,char **argv)
   ps.setscale(-2,-1.5,2,1.5,0);
   ps.setcolor(0,0,1);
   ps.startline();
-  for (i=0;i<1440;i+=1)
-  {
-    ag=agm(cossin(degtobin(i))*0.9,1,ag.branch);
-    ps.lineto(ag.m);
-    //printag(ag);
-  }
+  curve=AgmPathTracker([](double t){return cossin(degtobin(t))*0.9;}).track(1440);
+  for (i=0;i<curve.size();i++)
+    ps.lineto(curve[i]);
   ps.endline();
   ps.endpage();
   ps.startpage();
   ps.setcolor(0,0,1);
   ps.startline();
-  ag.branch="";
-  ag.m=1;
-  for (i=0;i<1440;i+=1)
-  {
-    ag=agm(cossin(degtobin(i))*1.1,1,ag.branch);
-    ps.lineto(ag.m);
-    //printag(ag);
-  }
+  curve=AgmPathTracker([](double t){return cossin(degtobin(t))*1.1;}).track(1440);
+  for (i=0;i<curve.size();i++)
+    ps.lineto(curve[i]);
   ps.endline();
   ps.endpage();
   ps.startpage();
   ps.setcolor(0,0,1);
   ps.startline();
-  ag.branch="";
-  ag.m=1;
-  for (i=0;i>-180;i--)
-  {
-    ag=agm(cossin(degtobin(i)),1,ag.branch);
-  }
-  for (i=-180;i<=180;i+=1)
-  {
-    ag=agm(cossin(degtobin(i)),1,ag.branch);
-    ps.lineto(ag.m);
-    //printag(ag);
-  }
+  AgmPathTracker unitCircle([](double t){return cossin(degtobin(t));});
+  unitCircle.track(-180);
+  curve=unitCircle.track(180);
+  for (i=0;i<curve.size();i++)
+    ps.lineto(curve[i]);
   ps.endline();
   ps.endpage();
   ps.startpage();
   ps.setcolor(0,0,1);
-  lattice=agmLattice(sqrt(2),1,8);
-  for (i=0;i<lattice.size();i++)
-  {
-    ps.dot(lattice[i]);
-  }
+  agmLattice(sqrt(2),1,8,0,AgmBranch(),[&ps](complex<double> m,const AgmBranch &)
+    {
+      ps.dot(m);
+    });
   ps.endpage();
   loops.resize(12);
   hi=-12;
@@ -631,8 +656,7 @@ int main(int argc,char **argv)
   mid=-16;
   while (hi>mid && mid>lo)
   {
-    loops[0]=khe.getLoop(mid);
-    if (loops[0].size()>64)
+    if (khe.loopView(mid).size()>64)
       hi=mid;
     else
       lo=mid;
@@ -760,6 +784,7 @@ int main(int argc,char **argv)
   cout<<pvAgm(pvAgm(2,3),pvAgm(5,7))<<' ';
   cout<<pvAgm(pvAgm(2,5),pvAgm(3,7))<<' ';
   cout<<pvAgm(pvAgm(2,7),pvAgm(5,3))<<endl;
+  //compareAgm1();
   /* The loop at x, as x approaches 0 from below, fits in a box {u+vi |
    * -t/3<u<t, -t/2<v<t/2}, where t*x=-π. This does not hold for x much less
    * than -1.
@@ -772,6 +797,7 @@ int main(int argc,char **argv)
   //sweep();
   //zoomIn();
   //rasterplot(khe,2000,2000,"khe.ppm");
+  //rasterplotAgm(complex<double>(-2,2),complex<double>(2,-2),2000,2000,"agm.ppm");
   fractions();
   modform();
   cout<<compand(1e-100)<<' '<<compand(100)<<endl;
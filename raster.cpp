@@ -14,6 +14,7 @@
 #include <stdexcept>
 #include "raster.h"
 #include "color.h"
+#include "taskpool.h"
 
 using namespace std;
 fstream rfile;
@@ -59,6 +60,7 @@ void rasterplot(Khe &khe,int width,int height,string filename)
   Color pixel;
   Colorize col;
   complex<double> pnt,z,p;
+  vector<complex<double> > pnts,values;
   double scale;
   FordCircle circle;
   vector<FordCircle> circles;
@@ -104,11 +106,16 @@ void rasterplot(Khe &khe,int width,int height,string filename)
   scale=2*M_PI/height;
   col.setLimits(abs(khe(complex<double>(-scale/2,M_PI))),abs(khe(-scale/2)));
   ppmheader(width,height);
+  for (i=0;i<height;i++)
+    for (j=0;j<width;j++)
+      pnts.push_back(complex<double>((j-width+0.5)*scale,(height/2.-i-0.5)*scale));
+  values.resize(pnts.size());
+  khe.evaluate(pnts,values);
   for (i=0;i<height;i++)
     for (j=0;j<width;j++)
     {
-      pnt=complex<double>((j-width+0.5)*scale,(height/2.-i-0.5)*scale);
-      z=khe(pnt);
+      pnt=pnts[i*width+j];
+      z=values[i*width+j];
       for (m=0;m<circles.size();m++)
 	if (circles[m].in(pnt))
 	{
@@ -126,3 +133,63 @@ void rasterplot(Khe &khe,int width,int height,string filename)
     }
   rclose();
 }
+
+void rasterplotAgm(complex<double> corner0,complex<double> corner1,int width,int height,
+		   string filename,const AgmBranch &branch)
+/* Plots agm(z,1) with corner0 at the top left and corner1 at the bottom
+ * right. Each pixel starts with the branch of the pixel to its left, or for
+ * the left column, the one above, beginning with branch, so that the plot
+ * follows one sheet of agm continuously, as main does along curves, and
+ * most pixels take the same steps as their neighbor. The left column is
+ * done first; then the rows are independent and are done in parallel.
+ */
+{
+  int i;
+  vector<complex<double> > values;
+  vector<AgmBranch> rowStart;
+  AgmResult ag;
+  TaskGroup group;
+  Colorize col;
+  double lo=INFINITY,hi=0,r;
+  complex<double> step;
+  if (width<=0 || height<=0)
+    throw(range_error("rasterplotAgm: size must be positive"));
+  step=complex<double>((corner1.real()-corner0.real())/width,(corner1.imag()-corner0.imag())/height);
+  values.resize((size_t)width*height);
+  rowStart.resize(height);
+  ag.branch=branch;
+  for (i=0;i<height;i++)
+  {
+    ag=agm(corner0+complex<double>(step.real()/2,(i+0.5)*step.imag()),1,ag.branch);
+    values[(size_t)i*width]=ag.m;
+    rowStart[i]=ag.branch;
+  }
+  for (i=0;i<height;i++)
+    taskPool().run(group,[&,i]()
+      {
+	int j;
+	AgmResult px;
+	px.branch=rowStart[i];
+	for (j=1;j<width;j++)
+	{
+	  px=agm(corner0+complex<double>((j+0.5)*step.real(),(i+0.5)*step.imag()),1,px.branch);
+	  values[(size_t)i*width+j]=px.m;
+	}
+      });
+  taskPool().wait(group);
+  for (i=0;i<values.size();i++)
+  {
+    r=abs(values[i]);
+    if (isfinite(r))
+    {
+      lo=min(lo,r);
+      hi=max(hi,r);
+    }
+  }
+  col.setLimits(lo,hi);
+  ropen(filename);
+  ppmheader(width,height);
+  for (i=0;i<values.size();i++)
+    rfile<<col(values[i]).ppm();
+  rclose();
+}
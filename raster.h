@@ -8,6 +8,7 @@
  * This file is part of AGM.
  */
 #include "khe.h"
+#include "agm.h"
 
 class FordCircle
 {
@@ -20,3 +21,5 @@ public:
 };
 
 void rasterplot(Khe &khe,int width,int height,std::string filename);
+void rasterplotAgm(std::complex<double> corner0,std::complex<double> corner1,int width,int height,
+		   std::string filename,const AgmBranch &branch=AgmBranch());
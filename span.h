@@ -0,0 +1,71 @@
+/******************************************************/
+/*                                                    */
+/* span.h - pointer and count                         */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#ifndef SPAN_H
+#define SPAN_H
+#include <cstddef>
+#include <vector>
+#include <type_traits>
+
+template<typename T> class Span
+/* A run of elements owned by something else, like std::span in C++20.
+ * This program is C++17, so it has its own. A Span<const T> can be made
+ * from a Span<T> or a const vector.
+ */
+{
+public:
+  Span():ptr(nullptr),len(0)
+  {
+  }
+  Span(T *p,size_t n):ptr(p),len(n)
+  {
+  }
+  Span(std::vector<typename std::remove_const<T>::type> &v):ptr(v.data()),len(v.size())
+  {
+  }
+  Span(const std::vector<typename std::remove_const<T>::type> &v):ptr(v.data()),len(v.size())
+  {
+  }
+  template<typename U> Span(const Span<U> &s):ptr(s.data()),len(s.size())
+  {
+  }
+  T *data() const
+  {
+    return ptr;
+  }
+  size_t size() const
+  {
+    return len;
+  }
+  bool empty() const
+  {
+    return len==0;
+  }
+  T &operator[](size_t i) const
+  {
+    return ptr[i];
+  }
+  T *begin() const
+  {
+    return ptr;
+  }
+  T *end() const
+  {
+    return ptr+len;
+  }
+  Span<T> subspan(size_t start,size_t n) const
+  {
+    return Span<T>(ptr+start,n);
+  }
+private:
+  T *ptr;
+  size_t len;
+};
+
+#endif
@@ -0,0 +1,168 @@
+/******************************************************/
+/*                                                    */
+/* taskpool.cpp - work-stealing pool of threads       */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#include "taskpool.h"
+using namespace std;
+
+thread_local TaskPool *workerPool=nullptr;
+thread_local unsigned workerQueue;
+
+TaskPool::TaskPool(unsigned nThreads)
+{
+  unsigned i;
+  if (nThreads==0)
+    nThreads=thread::hardware_concurrency();
+  if (nThreads==0)
+    nThreads=1;
+  queued=0;
+  stopping=false;
+  for (i=0;i<=nThreads;i++)
+    queues.push_back(unique_ptr<Queue>(new Queue));
+  for (i=0;i<nThreads;i++)
+    threads.push_back(thread(&TaskPool::work,this,i));
+}
+
+TaskPool::~TaskPool()
+{
+  int i;
+  {
+    lock_guard<mutex> lock(sleepMtx);
+    stopping=true;
+  }
+  wake.notify_all();
+  for (i=0;i<threads.size();i++)
+    threads[i].join();
+}
+
+unsigned TaskPool::self()
+// Returns the queue of the calling thread: its own if a worker, else the extra one.
+{
+  if (workerPool==this)
+    return workerQueue;
+  else
+    return threads.size();
+}
+
+void TaskPool::run(TaskGroup &group,function<void()> task)
+{
+  Queue &q=*queues[self()];
+  group.pending++;
+  {
+    lock_guard<mutex> lock(q.mtx);
+    q.tasks.push_back(Task{task,&group});
+  }
+  {
+    lock_guard<mutex> lock(sleepMtx);
+    queued++;
+  }
+  wake.notify_one();
+}
+
+bool TaskPool::runOne(unsigned q)
+/* Runs one task, from queue q if it has any, else stolen from another queue.
+ * Returns false if there was nothing to run.
+ */
+{
+  Task task;
+  unsigned i,nq=queues.size();
+  bool found=false;
+  for (i=0;!found && i<nq;i++)
+  {
+    Queue &victim=*queues[(q+i)%nq];
+    lock_guard<mutex> lock(victim.mtx);
+    if (victim.tasks.size())
+    {
+      found=true;
+      if (i)
+      {
+	task=victim.tasks.front();
+	victim.tasks.pop_front();
+      }
+      else
+      {
+	task=victim.tasks.back();
+	victim.tasks.pop_back();
+      }
+    }
+  }
+  if (found)
+  {
+    queued--;
+    task.fn();
+    task.group->pending--;
+  }
+  return found;
+}
+
+void TaskPool::work(unsigned q)
+{
+  workerPool=this;
+  workerQueue=q;
+  while (!stopping)
+    if (!runOne(q))
+    {
+      unique_lock<mutex> lock(sleepMtx);
+      wake.wait(lock,[this]{return queued>0 || stopping;});
+    }
+}
+
+void TaskPool::wait(TaskGroup &group)
+{
+  unsigned q=self();
+  while (group.pending>0)
+    if (!runOne(q))
+      this_thread::yield();
+}
+
+void TaskPool::forEach(unsigned n,const function<void(unsigned)> &fn)
+/* Calls fn(0) through fn(n-1), on the pool's threads and the calling
+ * thread. Unlike wait, it runs no other tasks while waiting, so it can be
+ * called holding a lock that some other task may want. The tasks it starts
+ * may outlive it, finding nothing left to do, so what they share is on the
+ * heap.
+ */
+{
+  struct Shared
+  {
+    TaskGroup group;
+    atomic<unsigned> next,done;
+    const function<void(unsigned)> *fn;
+    unsigned n;
+    void claim()
+    {
+      unsigned k;
+      while ((k=next++)<n)
+      {
+	(*fn)(k);
+	done++;
+      }
+    }
+  };
+  shared_ptr<Shared> sh=make_shared<Shared>();
+  unsigned i;
+  sh->next=0;
+  sh->done=0;
+  sh->fn=&fn;
+  sh->n=n;
+  for (i=0;i<threads.size() && i+1<n;i++)
+    run(sh->group,[sh]()
+      {
+	sh->claim();
+      });
+  sh->claim();
+  while (sh->done<n)
+    this_thread::yield();
+}
+
+TaskPool &taskPool()
+// The pool shared by everything in the program, started when first used.
+{
+  static TaskPool pool;
+  return pool;
+}
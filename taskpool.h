@@ -0,0 +1,77 @@
+/******************************************************/
+/*                                                    */
+/* taskpool.h - work-stealing pool of threads         */
+/*                                                    */
+/******************************************************/
+/* Copyright 2023 Pierre Abbat
+ * Licensed under the Apache License, Version 2.0.
+ * This file is part of AGM.
+ */
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+class TaskGroup
+/* A set of tasks to be waited for together. A task may add more tasks to
+ * its own group; waiting ends when all of them are done.
+ */
+{
+public:
+  TaskGroup()
+  {
+    pending=0;
+  }
+private:
+  std::atomic<int> pending;
+  friend class TaskPool;
+};
+
+class TaskPool
+/* Each worker thread has its own queue. It takes the newest task from its
+ * own queue, and when that is empty, steals the oldest task from another
+ * queue, which is likely to be a big one. Threads outside the pool put
+ * their tasks in an extra queue. A thread waiting for a group runs tasks
+ * instead of sleeping, so tasks can wait for tasks they start.
+ */
+{
+public:
+  TaskPool(unsigned nThreads=0); // 0 means as many as the hardware has
+  ~TaskPool();
+  void run(TaskGroup &group,std::function<void()> task);
+  void wait(TaskGroup &group);
+  void forEach(unsigned n,const std::function<void(unsigned)> &fn);
+  unsigned size()
+  {
+    return threads.size();
+  }
+private:
+  struct Task
+  {
+    std::function<void()> fn;
+    TaskGroup *group;
+  };
+  struct Queue
+  {
+    std::mutex mtx;
+    std::deque<Task> tasks;
+  };
+  std::vector<std::unique_ptr<Queue> > queues;
+  std::vector<std::thread> threads;
+  std::atomic<int> queued;
+  std::atomic<bool> stopping;
+  std::mutex sleepMtx;
+  std::condition_variable wake;
+  unsigned self();
+  bool runOne(unsigned q);
+  void work(unsigned q);
+};
+
+TaskPool &taskPool();
+#endif